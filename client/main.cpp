@@ -1,6 +1,8 @@
 // Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
 // Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
 
+#include <algorithm>
+#include <cmath>
 #include <future>
 #include <iostream>
 #include <sstream>
@@ -9,6 +11,7 @@
 
 #include "server-connection.hpp"
 #include "server-message.hpp"
+#include "command-history.hpp"
 #include "controllers/fps-controller.hpp"
 #include "events.hpp"
 #include "event-system.hpp"
@@ -81,6 +84,7 @@ int main(int argc, char* argv[]) {
 	tec::Simulation simulation;
 	tec::GameStateQueue game_state_queue;
 	tec::networking::ServerConnection connection;
+	connection.EnableUDP(true);
 
 	console.AddConsoleCommand(
 		"msg",
@@ -95,6 +99,13 @@ int main(int argc, char* argv[]) {
 			connection.SendChatMessage(message);
 		});
 
+	console.AddConsoleCommand(
+		"server_stats",
+		"server_stats : Shows how long each phase of the server's ticks takes.",
+		[&connection] (const char*) {
+			connection.RequestServerStats();
+		});
+
 	console.AddConsoleCommand(
 		"connect",
 		"connect ip : Connects to the server at ip",
@@ -168,7 +179,9 @@ int main(int argc, char* argv[]) {
 		});
 
 	double delta_accumulator = 0.0; // Accumulated deltas since the last update was sent.
-	tec::state_id_t command_id = 0;
+	tec::state_id_t command_id = 1; // Updates ack command 0 before any have been applied.
+	tec::CommandHistory command_history;
+	tec::state_id_t command_tick = 0; // Server tick the last command was predicted to apply on.
 
 	while (!os.Closing()) {
 		os.OSMessageLoop();
@@ -189,12 +202,24 @@ int main(int argc, char* argv[]) {
 				tec::networking::ServerMessage update_message;
 				tec::proto::ClientCommands client_commands = camera_controller->GetClientCommands();
 				client_commands.set_commandid(command_id++);
+				// The newest state we have is already half a round trip old, and these take
+				// another half to reach the server. One command is sent per tick so ticks only
+				// ever move forward, even when the ping estimate drops.
+				const double ping_ticks = 2.0 * connection.GetAveragePing() / (tec::UPDATE_RATE * 1000.0);
+				command_tick = std::max(command_tick + 1,
+					connection.GetLastRecvStateID() + 1 + static_cast<tec::state_id_t>(std::ceil(ping_ticks)));
+				client_commands.set_tick(command_tick);
+				// Resend whatever the server hasn't applied yet, in case it was lost.
+				command_history.Ack(connection.GetLastAckedCommandID());
+				command_history.AddPreviousCommands(client_commands);
 				update_message.SetStateID(connection.GetLastRecvStateID());
 				update_message.SetMessageType(tec::networking::MessageType::CLIENT_COMMAND);
 				client_commands.SerializeToArray(update_message.GetBodyPTR(), client_commands.ByteSize());
 				update_message.SetBodyLength(client_commands.ByteSize());
 				update_message.encode_header();
 				connection.Send(update_message);
+				// Predict with the same step the server will take for this command.
+				camera_controller->ApplyClientCommands(client_commands);
 				game_state_queue.SetCommandID(command_id);
 			}
 
@@ -5,6 +5,7 @@
 #include "events.hpp"
 #include "event-system.hpp"
 #include "game-state.hpp"
+#include "snapshot-delta.hpp"
 
 using asio::ip::tcp;
 
@@ -15,7 +16,7 @@ namespace tec {
 		std::shared_ptr<spdlog::logger> ServerConnection::_log;
 		std::mutex ServerConnection::recent_ping_mutex;
 
-		ServerConnection::ServerConnection() : socket(io_service) {
+		ServerConnection::ServerConnection() : socket(io_service), udp_socket(io_service) {
 			_log = spdlog::get("console_log");
 			RegisterMessageHandler(MessageType::SYNC, [this] (const ServerMessage& message) {
 				this->SyncHandler(message);
@@ -39,17 +40,39 @@ namespace tec {
 				data->entity_id = entity_id;
 				EventSystem<EntityDestroyed>::Get()->Emit(data);
 								   });
-			RegisterMessageHandler(MessageType::ENTITY_CREATE, [this](const ServerMessage&) {
+			RegisterMessageHandler(MessageType::COMPRESSION, [] (const ServerMessage& message) {
+				std::string codec(message.GetBodyPTR(), message.GetBodyLength());
+				_log->info("Server compression codec: " + (codec.empty() ? std::string("none") : codec));
+								   });
+			RegisterMessageHandler(MessageType::SERVER_STATS, [] (const ServerMessage& message) {
+				_log->info("Server tick profile:\n" + std::string(message.GetBodyPTR(), message.GetBodyLength()));
+								   });
+			RegisterMessageHandler(MessageType::UDP_HANDSHAKE, [this] (const ServerMessage& message) {
+				this->UDPHandshakeHandler(message);
+								   });
+			RegisterMessageHandler(MessageType::ENTITY_CREATE, [] (const ServerMessage& message) {
 				std::shared_ptr<EntityCreated> data = std::make_shared<EntityCreated>();
-				data->entity.ParseFromArray(current_read_msg.GetBodyPTR(), static_cast<int>(current_read_msg.GetBodyLength()));
+				data->entity.ParseFromArray(message.GetBodyPTR(), static_cast<int>(message.GetBodyLength()));
 				data->entity_id = data->entity.id();
 				EventSystem<EntityCreated>::Get()->Emit(data);
 								   });
+			// Sent when an entity leaves this client's area of interest.
+			RegisterMessageHandler(MessageType::ENTITY_DESTROY, [] (const ServerMessage& message) {
+				std::string id_message(message.GetBodyPTR(), message.GetBodyLength());
+				std::shared_ptr<EntityDestroyed> data = std::make_shared<EntityDestroyed>();
+				data->entity_id = std::atoi(id_message.c_str());
+				EventSystem<EntityDestroyed>::Get()->Emit(data);
+								   });
 		}
 
 		bool ServerConnection::Connect(std::string ip) {
 			this->client_id = 0;
 			this->socket.close();
+			this->udp_socket.close();
+			this->udp_established = false;
+			this->receive_buffer.Clear();
+			this->received_states.clear();
+			this->last_acked_command_id = 0;
 			tcp::resolver resolver(this->io_service);
 			tcp::resolver::query query(ip, SERVER_PORT_STR);
 			asio::error_code error = asio::error::host_not_found;
@@ -69,6 +92,16 @@ namespace tec {
 				return false;
 			}
 
+			// Offer the codecs we can decompress. The server compresses what it sends from then on,
+			// flagging each compressed message, if it supports one of them.
+			std::string codecs(SUPPORTED_CODECS);
+			ServerMessage compression_msg;
+			compression_msg.SetMessageType(MessageType::COMPRESSION);
+			compression_msg.SetBodyLength(codecs.size());
+			memcpy(compression_msg.GetBodyPTR(), codecs.c_str(), compression_msg.GetBodyLength());
+			compression_msg.encode_header();
+			Send(compression_msg);
+
 			if (this->onConnect) {
 				this->onConnect();
 			}
@@ -78,11 +111,14 @@ namespace tec {
 
 		void ServerConnection::Disconnect() {
 			this->socket.close();
-			this->stopped = true;
+			this->udp_socket.close();
+			this->udp_established = false;
+			Stop();
 		}
 
 		void ServerConnection::Stop() {
 			this->stopped = true;
+			this->io_service.stop();
 		}
 
 		void ServerConnection::SendChatMessage(std::string message) {
@@ -95,7 +131,25 @@ namespace tec {
 			}
 		}
 
+		void ServerConnection::RequestServerStats() {
+			if (this->socket.is_open()) {
+				ServerMessage msg;
+				msg.SetMessageType(MessageType::SERVER_STATS);
+				msg.SetBodyLength(0);
+				msg.encode_header();
+				Send(msg);
+			}
+		}
+
 		void ServerConnection::Send(ServerMessage& msg) {
+			if (this->udp_established) {
+				std::lock_guard<std::mutex> lock(udp_channel_mutex);
+				if (this->udp_channel.Queue(msg)) {
+					SendDatagram();
+					return;
+				}
+				// The server has stopped acking, so this one goes over TCP.
+			}
 			try {
 				asio::write(this->socket, asio::buffer(msg.GetDataPTR(), msg.length()));
 			}
@@ -107,51 +161,114 @@ namespace tec {
 			this->onConnect = std::move(func);
 		}
 
-		void ServerConnection::read_body() {
-			asio::error_code error = asio::error::eof;
-			asio::read(this->socket,
-					   asio::buffer(current_read_msg.GetBodyPTR(), current_read_msg.GetBodyLength()),
-					   error);
+		void ServerConnection::read() {
+			this->socket.async_read_some(
+				asio::buffer(this->receive_buffer.GetWritePTR(), this->receive_buffer.GetWriteSpace()),
+				[this] (std::error_code error, std::size_t length) {
+					if (error) {
+						if (error != asio::error::operation_aborted) {
+							std::cerr << error.message() << std::endl;
+						}
+						this->socket.close();
+						return;
+					}
+					this->recv_time = std::chrono::high_resolution_clock::now();
+					this->receive_buffer.Commit(length);
 
-			if (!error) {
-				for (auto handler : this->message_handlers[current_read_msg.GetMessageType()]) {
-					handler(current_read_msg);
-				}
+					// A single read can complete any number of messages.
+					ReceiveBuffer::Result result;
+					while ((result = this->receive_buffer.Next(this->current_read_msg)) == ReceiveBuffer::Result::MESSAGE) {
+						dispatch(this->current_read_msg);
+					}
+					if (result == ReceiveBuffer::Result::INVALID) {
+						std::cerr << "Invalid message header from server" << std::endl;
+						this->socket.close();
+						return;
+					}
+					read();
+				});
+		}
+
+		void ServerConnection::dispatch(ServerMessage& msg) {
+			if (!this->decompressor.Decompress(msg)) {
+				_log->warn("Dropped a message that failed to decompress");
+				return;
 			}
-			else if (error) {
-				this->socket.close();
-				throw asio::system_error(error);
+			for (auto& handler : this->message_handlers[msg.GetMessageType()]) {
+				handler(msg);
 			}
 		}
 
-		void ServerConnection::read_header() {
-			asio::error_code error = asio::error::eof;
-			asio::read(this->socket,
-					   asio::buffer(this->current_read_msg.GetDataPTR(), ServerMessage::header_length), error);
-			this->recv_time = std::chrono::high_resolution_clock::now();
-
-			if (!error && this->current_read_msg.decode_header()) {
-				read_body();
+		void ServerConnection::UDPHandshakeHandler(const ServerMessage& message) {
+			if (!this->udp_enabled) {
+				return;
+			}
+			std::string id_message(message.GetBodyPTR(), message.GetBodyLength());
+			std::lock_guard<std::mutex> lock(udp_channel_mutex);
+			this->udp_channel = ReliableChannel(static_cast<std::uint32_t>(std::stoul(id_message)));
+			std::error_code error;
+			this->udp_socket.close();
+			this->udp_socket.open(udp::v4(), error);
+			if (!error) {
+				tcp::endpoint server_endpoint = this->socket.remote_endpoint(error);
+				this->udp_socket.connect(udp::endpoint(server_endpoint.address(), server_endpoint.port()), error);
 			}
-			else if (error) {
-				this->socket.close();
-				throw asio::system_error(error);
+			if (error) {
+				_log->warn("Couldn't open a UDP channel, staying on TCP: " + error.message());
+				this->udp_socket.close();
+				return;
 			}
+			udp_read();
+			SendDatagram(); // The server switches over once this (or a later one) arrives.
+		}
+
+		// Must be called with udp_channel_mutex held.
+		void ServerConnection::SendDatagram() {
+			char datagram[ReliableChannel::max_packet_size];
+			do {
+				std::size_t length = this->udp_channel.WritePacket(datagram, sizeof(datagram));
+				std::error_code error;
+				this->udp_socket.send(asio::buffer(datagram, length), 0, error);
+			} while (this->udp_channel.HasPending());
+		}
+
+		void ServerConnection::udp_read() {
+			this->udp_socket.async_receive(
+				asio::buffer(this->udp_recv_buffer),
+				[this] (std::error_code error, std::size_t length) {
+					if (error) {
+						// Port unreachable and the like just leave us on TCP.
+						if (error != asio::error::operation_aborted && this->udp_socket.is_open()) {
+							udp_read();
+						}
+						return;
+					}
+					std::vector<ServerMessage> messages;
+					bool valid;
+					{
+						std::lock_guard<std::mutex> lock(udp_channel_mutex);
+						valid = this->udp_channel.ReadPacket(this->udp_recv_buffer, length, [&messages] (ServerMessage& msg) {
+							messages.push_back(msg);
+						});
+					}
+					if (valid) {
+						this->udp_established = true;
+						this->recv_time = std::chrono::high_resolution_clock::now();
+						for (ServerMessage& msg : messages) {
+							dispatch(msg);
+						}
+					}
+					udp_read();
+				});
 		}
 
 		void ServerConnection::StartRead() {
 			this->stopped = false;
-			while (!this->stopped) {
-				try {
-					if (this->socket.is_open() && this->socket.available()) {
-						read_header();
-					}
-				}
-				catch (std::exception e) {
-					std::cout << e.what();
-				}
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			this->io_service.restart();
+			if (this->socket.is_open()) {
+				read();
 			}
+			this->io_service.run();
 		}
 
 		void ServerConnection::StartSync() {
@@ -164,6 +281,11 @@ namespace tec {
 				if (this->stopped) {
 					return;
 				}
+				if (this->udp_socket.is_open() && !this->udp_established) {
+					// Keep knocking until the server answers over UDP.
+					std::lock_guard<std::mutex> lock(udp_channel_mutex);
+					SendDatagram();
+				}
 				Send(sync_msg);
 				this->sync_start = std::chrono::high_resolution_clock::now();
 				std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -185,16 +307,41 @@ namespace tec {
 		}
 
 		void ServerConnection::GameStateUpdateHandler(const ServerMessage& message) {
-			proto::GameStateUpdate gsu;
-			gsu.ParseFromArray(message.GetBodyPTR(), static_cast<int>(message.GetBodyLength()));
-			state_id_t recv_state_id = gsu.state_id();
+			// Decoded in place rather than parsed into a GameStateUpdate, as this runs for every snapshot.
+			StateUpdateHeader header;
+			if (!ReadStateUpdateHeader(message.GetBodyPTR(), message.GetBodyLength(), header)) {
+				_log->warn("Received a malformed GameStateUpdate");
+				return;
+			}
+			state_id_t recv_state_id = header.state_id;
 			if (recv_state_id <= this->last_received_state_id) {
 				_log->warn("Received an older GameStateUpdate");
 			}
 			else {
-				this->last_received_state_id = recv_state_id;
+				// The server deltas against the newest state it knows we have, so anything
+				// older than that baseline won't be needed again.
+				static const GameState empty_state;
+				const GameState* baseline = &empty_state;
+				if (header.baseline_state_id != 0) {
+					auto itr = this->received_states.find(header.baseline_state_id);
+					if (itr == this->received_states.end()) {
+						_log->warn("Received a GameStateUpdate against an unknown baseline");
+						return;
+					}
+					baseline = &itr->second;
+				}
 				GameState next_state;
-				next_state.In(gsu);
+				if (!ApplyStateDelta(*baseline, message.GetBodyPTR(), message.GetBodyLength(), next_state)) {
+					_log->warn("Received a malformed GameStateUpdate");
+					return;
+				}
+				this->received_states.erase(this->received_states.begin(), this->received_states.lower_bound(header.baseline_state_id));
+				while (this->received_states.size() >= max_received_states) {
+					this->received_states.erase(this->received_states.begin());
+				}
+				this->received_states.emplace(recv_state_id, next_state);
+				this->last_received_state_id = recv_state_id;
+				this->last_acked_command_id = header.command_id;
 				std::shared_ptr<NewGameStateEvent> new_game_state_msg = std::make_shared<NewGameStateEvent>();
 				new_game_state_msg->new_state = std::move(next_state);
 				EventSystem<NewGameStateEvent>::Get()->Emit(new_game_state_msg);
@@ -16,8 +16,13 @@
 #include <spdlog/spdlog.h>
 
 #include "server-message.hpp"
+#include "game-state.hpp"
+#include "receive-buffer.hpp"
+#include "reliable-channel.hpp"
+#include "message-compression.hpp"
 
 using asio::ip::tcp;
+using asio::ip::udp;
 
 namespace tec {
 	extern std::map<tid, std::function<void(const proto::Entity&, const proto::Component&)>> in_functors;
@@ -42,19 +47,33 @@ namespace tec {
 
 			void Stop(); // Stop read and sync loops.
 
-			void StartRead(); // Starts the read loop.
+			void StartRead(); // Runs the read loop on the calling thread until Stop() or the connection drops.
 
 			void StartSync(); // Starts the sync loop.
 
 			void SendChatMessage(std::string message); // Send a ServerMessage with type CHAT_MESSAGE.
 
+			void RequestServerStats(); // Asks the server for its tick profile, which is logged when it arrives.
+
+			// Sends over the UDP channel once it is established, otherwise over TCP.
 			void Send(ServerMessage& msg);
 
+			// Use a UDP channel alongside TCP if the server offers one. TCP stays as the
+			// fallback until the server has answered over UDP.
+			void EnableUDP(bool enable) {
+				this->udp_enabled = enable;
+			}
+
 			// Gets the last received state ID.
 			state_id_t GetLastRecvStateID() {
 				return this->last_received_state_id;
 			}
 
+			// Newest command the server says it has applied.
+			state_id_t GetLastAckedCommandID() {
+				return this->last_acked_command_id;
+			}
+
 			// Get a list of recent pings.
 			std::list<ping_time_t> GetRecentPings() {
 				std::lock_guard<std::mutex> recent_ping_lock(recent_ping_mutex);
@@ -79,8 +98,12 @@ namespace tec {
 			void RegisterConnectFunc(std::function<void()> func);
 
 		private:
-			void read_body(); // Used by the read loop. Calls read_header after the whole body is read.
-			void read_header(); // Used by the read lop. Calls read_body after the header section is read.
+			void read(); // Used by the read loop. Dispatches every complete message read then reads again.
+
+			void udp_read(); // Reads datagrams from the server on the read loop.
+			void dispatch(ServerMessage& msg); // Decompresses msg if needed and calls its handlers.
+			void SendDatagram(); // Sends whatever is queued on the UDP channel.
+			void UDPHandshakeHandler(const ServerMessage& message);
 
 			void SyncHandler(const ServerMessage& message);
 			void GameStateUpdateHandler(const ServerMessage& message);
@@ -94,8 +117,20 @@ namespace tec {
 			asio::ip::tcp::socket socket;
 
 			// Read loop variables
+			ReceiveBuffer receive_buffer;
 			ServerMessage current_read_msg;
 			std::atomic<bool> stopped;
+			// Decompresses with the codec we offered. Both TCP and UDP reads complete on the
+			// read loop so one is enough.
+			MessageDecompressor decompressor;
+
+			// UDP channel variables
+			bool udp_enabled{ false };
+			std::atomic<bool> udp_established{ false }; // The server has answered over UDP.
+			udp::socket udp_socket;
+			ReliableChannel udp_channel;
+			std::mutex udp_channel_mutex;
+			char udp_recv_buffer[ReliableChannel::max_packet_size];
 
 			// Ping variables
 			std::chrono::high_resolution_clock::time_point sync_start, recv_time;
@@ -108,6 +143,10 @@ namespace tec {
 
 			// State management variables
 			state_id_t last_received_state_id{ 0 };
+			std::atomic<state_id_t> last_acked_command_id{ 0 };
+			// Recently received states, rebuilt in full, that later updates may be deltas against.
+			std::map<state_id_t, GameState> received_states;
+			enum { max_received_states = 64 };
 
 			std::unordered_map<MessageType, std::list<handlerFunc>> message_handlers;
 
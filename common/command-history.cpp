@@ -0,0 +1,77 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "command-history.hpp"
+
+#include <algorithm>
+
+#include <google/protobuf/util/message_differencer.h>
+
+namespace tec {
+	std::size_t REDUNDANT_COMMAND_COUNT = 4;
+
+	using google::protobuf::util::MessageDifferencer;
+
+	void CommandHistory::Ack(std::uint64_t command_id) {
+		while (!this->unacked.empty() && this->unacked.front().commandid() <= command_id) {
+			this->unacked.pop_front();
+		}
+	}
+
+	void CommandHistory::AddPreviousCommands(proto::ClientCommands& command) {
+		command.clear_previous();
+		const proto::ClientCommands* newer = &command;
+		std::uint64_t expected_id = command.commandid();
+		for (auto itr = this->unacked.rbegin(); itr != this->unacked.rend(); ++itr) {
+			if (static_cast<std::size_t>(command.previous_size()) >= REDUNDANT_COMMAND_COUNT ||
+				itr->commandid() + 1 != expected_id) {
+				break;
+			}
+			proto::PreviousCommand* previous = command.add_previous();
+			if (newer->tick() - itr->tick() != 1) {
+				previous->set_tick_offset(static_cast<std::uint32_t>(newer->tick() - itr->tick()));
+			}
+			if (!MessageDifferencer::Equals(itr->movement(), newer->movement())) {
+				*previous->mutable_movement() = itr->movement();
+			}
+			if (itr->has_orientation() && !MessageDifferencer::Equals(itr->orientation(), newer->orientation())) {
+				*previous->mutable_orientation() = itr->orientation();
+			}
+			*previous->mutable_commandlist() = itr->commandlist();
+			newer = &*itr;
+			expected_id = itr->commandid();
+		}
+
+		this->unacked.push_back(command);
+		this->unacked.back().clear_previous();
+		while (this->unacked.size() > REDUNDANT_COMMAND_COUNT) {
+			this->unacked.pop_front();
+		}
+	}
+
+	void ExpandClientCommands(const proto::ClientCommands& command, std::vector<proto::ClientCommands>& out) {
+		const std::size_t first = out.size();
+		proto::ClientCommands newer = command;
+		newer.clear_previous();
+		for (const proto::PreviousCommand& previous : command.previous()) {
+			if (newer.commandid() == 0) {
+				break;
+			}
+			proto::ClientCommands older = newer;
+			older.set_commandid(newer.commandid() - 1);
+			older.set_tick(newer.tick() - (previous.has_tick_offset() ? previous.tick_offset() : 1));
+			if (previous.has_movement()) {
+				*older.mutable_movement() = previous.movement();
+			}
+			if (previous.has_orientation()) {
+				*older.mutable_orientation() = previous.orientation();
+			}
+			*older.mutable_commandlist() = previous.commandlist();
+			out.push_back(newer);
+			newer = std::move(older);
+		}
+		out.push_back(std::move(newer));
+		// Built newest first, so flip them round.
+		std::reverse(out.begin() + first, out.end());
+	}
+}
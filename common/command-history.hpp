@@ -0,0 +1,37 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <commands.pb.h>
+
+namespace tec {
+	// Most unacked commands resent with each new one. Bounds the extra bandwidth, and how many
+	// consecutive lost messages the server can recover from.
+	extern std::size_t REDUNDANT_COMMAND_COUNT;
+
+	// Remembers the commands a client has sent so each message can carry the ones the server
+	// hasn't acked yet, in case the messages they were first sent in were lost.
+	class CommandHistory {
+	public:
+		// Forgets every command up to and including command_id.
+		void Ack(std::uint64_t command_id);
+
+		// Adds the unacked commands before command to it as deltas, newest first, then records it.
+		// Commands must be added with consecutive command ids.
+		void AddPreviousCommands(proto::ClientCommands& command);
+
+		void Clear() {
+			this->unacked.clear();
+		}
+	private:
+		std::deque<proto::ClientCommands> unacked; // Oldest first, without their own previous commands.
+	};
+
+	// Rebuilds the full commands carried by a message, oldest first, ending with the message's own.
+	void ExpandClientCommands(const proto::ClientCommands& command, std::vector<proto::ClientCommands>& out);
+}
@@ -10,6 +10,7 @@
 
 #include "components/transforms.hpp"
 #include "events.hpp"
+#include "simulation.hpp"
 
 namespace tec {
 	void FPSController::Update(double delta, GameState& state, EventList& commands) {
@@ -31,31 +32,29 @@ namespace tec {
 			Handle(mouse_move_event, state);
 		}
 
-		int forwardDirection = 0;
-		int strafeDirection = 0;
-
 		if ((this->KEY_W_DOWN && this->KEY_W_FIRST) || this->forward) {
-			forwardDirection = -1;
 			this->forward = true;
 		}
 		else if (this->KEY_S_DOWN || this->backward) {
-			forwardDirection = 1;
 			this->backward = true;
 		}
 		if ((this->KEY_A_DOWN && this->KEY_A_FIRST) || this->left_strafe) {
-			strafeDirection = -1;
 			this->left_strafe = true;
 		}
 		else if (this->KEY_D_DOWN || this->right_strafe) {
-			strafeDirection = 1;
 			this->right_strafe = true;
 		}
 
+		if (this->has_pending_command) {
+			this->movement = StepMovement(this->movement, this->pending_command, static_cast<float>(UPDATE_RATE));
+			this->has_pending_command = false;
+		}
+
 		if (state.orientations.find(entity_id) != state.orientations.end()) {
 			state.orientations[entity_id] = *this->orientation;
 		}
 
-		state.velocities[entity_id].linear = glm::vec4(this->orientation->value * glm::vec3(5.0 * strafeDirection, 0.0, 7.5 * forwardDirection), 1.0);
+		state.velocities[entity_id].linear = glm::vec4(this->movement.velocity, 1.0);
 	}
 
 	proto::ClientCommands FPSController::GetClientCommands() {
@@ -117,6 +116,10 @@ namespace tec {
 	}
 
 	void FPSController::ApplyClientCommands(proto::ClientCommands proto_client_commands) {
+		if (proto_client_commands.tick() < this->last_command_tick) {
+			return; // Arrived after a newer one was already applied.
+		}
+		this->last_command_tick = proto_client_commands.tick();
 		if (proto_client_commands.has_movement()) {
 			const proto::MovementCommand& movement_commands = proto_client_commands.movement();
 			this->forward = movement_commands.forward();
@@ -137,6 +140,8 @@ namespace tec {
 			this->orientation->value.z = orientation_command.z();
 			this->orientation->value.w = orientation_command.w();
 		}
+		this->pending_command = std::move(proto_client_commands);
+		this->has_pending_command = true;
 	}
 
 	void FPSController::Handle(const KeyboardEvent& data, const GameState&) {
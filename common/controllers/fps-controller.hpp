@@ -10,6 +10,7 @@
 #include "types.hpp"
 #include "game-state.hpp"
 #include "events.hpp"
+#include "controllers/movement.hpp"
 
 namespace tec {
 	// TODO: Create Controller system that calls update on all controller
@@ -52,6 +53,13 @@ namespace tec {
 
 		std::unique_ptr<Orientation> orientation;
 
+		// Movement is only stepped by commands, one UPDATE_RATE step each, the same way on the
+		// client (predicting) and on the server.
+		MovementState movement;
+		proto::ClientCommands pending_command;
+		bool has_pending_command{ false };
+		std::uint64_t last_command_tick{ 0 };
+
 		// These tell us which was pressed first.
 		bool KEY_A_FIRST{ false };
 		bool KEY_W_FIRST{ false };
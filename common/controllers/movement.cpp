@@ -0,0 +1,52 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "controllers/movement.hpp"
+
+#include <cmath>
+
+namespace tec {
+	float MOVEMENT_FORWARD_SPEED = 7.5f;
+	float MOVEMENT_STRAFE_SPEED = 5.0f;
+	float MOVEMENT_ACCELERATION = 60.0f;
+
+	MovementState StepMovement(const MovementState& state, const proto::ClientCommands& command, float dt) {
+		MovementState next = state;
+		if (command.has_orientation()) {
+			const proto::OrientationCommand& orientation = command.orientation();
+			next.orientation = glm::quat(orientation.w(), orientation.x(), orientation.y(), orientation.z());
+		}
+
+		float forward_direction = 0.0f;
+		float strafe_direction = 0.0f;
+		if (command.has_movement()) {
+			const proto::MovementCommand& movement = command.movement();
+			if (movement.forward()) {
+				forward_direction = -1.0f;
+			}
+			else if (movement.backward()) {
+				forward_direction = 1.0f;
+			}
+			if (movement.leftstrafe()) {
+				strafe_direction = -1.0f;
+			}
+			else if (movement.rightstrafe()) {
+				strafe_direction = 1.0f;
+			}
+		}
+		const glm::vec3 target = next.orientation *
+			glm::vec3(MOVEMENT_STRAFE_SPEED * strafe_direction, 0.0f, MOVEMENT_FORWARD_SPEED * forward_direction);
+
+		// Move towards the target at no more than the acceleration allows this step.
+		const glm::vec3 change = target - state.velocity;
+		const float change_length = std::sqrt(glm::dot(change, change));
+		const float max_change = MOVEMENT_ACCELERATION * dt;
+		if (change_length <= max_change) {
+			next.velocity = target;
+		}
+		else {
+			next.velocity = state.velocity + change * (max_change / change_length);
+		}
+		return next;
+	}
+}
@@ -0,0 +1,30 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <commands.pb.h>
+
+namespace tec {
+	// Top speeds along the entity's own axes, in units per second.
+	extern float MOVEMENT_FORWARD_SPEED;
+	extern float MOVEMENT_STRAFE_SPEED;
+
+	// How quickly velocity approaches the commanded speed, in units per second squared.
+	extern float MOVEMENT_ACCELERATION;
+
+	// The part of a controlled entity's motion that comes from its commands. Positions are left
+	// to the physics step so collisions and gravity still apply.
+	struct MovementState {
+		glm::quat orientation{ 1.f, 0.f, 0.f, 0.f };
+		glm::vec3 velocity{ 0.f, 0.f, 0.f };
+	};
+
+	// Advances state by one command over a fixed dt. Depends on nothing but its arguments, so the
+	// client's prediction and the server's authoritative step give bit-identical results when
+	// fed the same commands.
+	MovementState StepMovement(const MovementState& state, const proto::ClientCommands& command, float dt);
+}
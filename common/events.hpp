@@ -68,6 +68,7 @@ namespace tec {
 
 	struct ClientCommandsEvent {
 		proto::ClientCommands client_commands;
+		state_id_t state_id{ 0 }; // Newest state the client had received when it sent these.
 	};
 
 	struct Controller;
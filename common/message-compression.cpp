@@ -0,0 +1,108 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "message-compression.hpp"
+
+#include <cstring>
+#include <sstream>
+
+namespace tec {
+	namespace networking {
+		bool MESSAGE_COMPRESSION = true;
+		std::size_t COMPRESSION_THRESHOLD = 96;
+		const char* SUPPORTED_CODECS = "zlib";
+
+		// Raw deflate with a window as big as the largest body, which is all a single message
+		// can refer back to anyway. Keeps the per connection state small and skips the zlib
+		// header and checksum.
+		static const int WINDOW_BITS = -9;
+		static const int MEMORY_LEVEL = 4;
+
+		CompressionCodec PickCodec(const std::string& offer) {
+			std::istringstream codecs(offer);
+			std::string codec;
+			while (std::getline(codecs, codec, ',')) {
+				if (codec == "zlib") {
+					return CompressionCodec::ZLIB;
+				}
+			}
+			return CompressionCodec::NONE;
+		}
+
+		const char* GetCodecName(CompressionCodec codec) {
+			switch (codec) {
+				case CompressionCodec::ZLIB:
+				return "zlib";
+				default:
+				return "";
+			}
+		}
+
+		MessageCompressor::MessageCompressor() {
+			std::memset(&this->stream, 0, sizeof(this->stream));
+			this->initialized = deflateInit2(&this->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				WINDOW_BITS, MEMORY_LEVEL, Z_DEFAULT_STRATEGY) == Z_OK;
+		}
+
+		MessageCompressor::~MessageCompressor() {
+			if (this->initialized) {
+				deflateEnd(&this->stream);
+			}
+		}
+
+		bool MessageCompressor::Compress(ServerMessage& msg) {
+			if (!this->initialized || msg.IsCompressed() || msg.GetBodyLength() < COMPRESSION_THRESHOLD) {
+				return false;
+			}
+			deflateReset(&this->stream);
+			this->stream.next_in = reinterpret_cast<Bytef*>(msg.GetBodyPTR());
+			this->stream.avail_in = static_cast<uInt>(msg.GetBodyLength());
+			this->stream.next_out = reinterpret_cast<Bytef*>(this->scratch);
+			// Anything that doesn't save at least a byte isn't worth it.
+			this->stream.avail_out = static_cast<uInt>(msg.GetBodyLength() - 1);
+			if (deflate(&this->stream, Z_FINISH) != Z_STREAM_END) {
+				return false;
+			}
+			const std::size_t compressed_length = this->stream.total_out;
+			std::memcpy(msg.GetBodyPTR(), this->scratch, compressed_length);
+			msg.SetBodyLength(compressed_length);
+			msg.SetCompressed(true);
+			msg.encode_header();
+			return true;
+		}
+
+		MessageDecompressor::MessageDecompressor() {
+			std::memset(&this->stream, 0, sizeof(this->stream));
+			this->initialized = inflateInit2(&this->stream, WINDOW_BITS) == Z_OK;
+		}
+
+		MessageDecompressor::~MessageDecompressor() {
+			if (this->initialized) {
+				inflateEnd(&this->stream);
+			}
+		}
+
+		bool MessageDecompressor::Decompress(ServerMessage& msg) {
+			if (!msg.IsCompressed()) {
+				return true;
+			}
+			if (!this->initialized) {
+				return false;
+			}
+			inflateReset(&this->stream);
+			this->stream.next_in = reinterpret_cast<Bytef*>(msg.GetBodyPTR());
+			this->stream.avail_in = static_cast<uInt>(msg.GetBodyLength());
+			this->stream.next_out = reinterpret_cast<Bytef*>(this->scratch);
+			this->stream.avail_out = sizeof(this->scratch);
+			if (inflate(&this->stream, Z_FINISH) != Z_STREAM_END) {
+				return false;
+			}
+			const std::size_t length = this->stream.total_out;
+			std::memcpy(msg.GetBodyPTR(), this->scratch, length);
+			msg.SetBodyLength(length);
+			msg.SetCompressed(false);
+			msg.encode_header();
+			return true;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <string>
+
+#include <zlib.h>
+
+#include "server-message.hpp"
+
+namespace tec {
+	namespace networking {
+		// Turns compression of outgoing messages on or off. Clients still offer codecs either way.
+		extern bool MESSAGE_COMPRESSION;
+
+		// Bodies shorter than this are never worth compressing.
+		extern std::size_t COMPRESSION_THRESHOLD;
+
+		enum class CompressionCodec {
+			NONE,
+			ZLIB,
+		};
+
+		// Codecs this build can compress and decompress, comma separated, in order of preference.
+		extern const char* SUPPORTED_CODECS;
+
+		// The first codec in offer (as sent in a COMPRESSION message) this build supports.
+		CompressionCodec PickCodec(const std::string& offer);
+
+		const char* GetCodecName(CompressionCodec codec);
+
+		// Compresses message bodies one at a time, each decompressible on its own so unreliable
+		// messages can be lost. One per connection, so the deflate state is set up once and reset
+		// per message rather than allocated each time. Not thread safe.
+		class MessageCompressor {
+		public:
+			MessageCompressor();
+			~MessageCompressor();
+			MessageCompressor(const MessageCompressor&) = delete;
+			MessageCompressor& operator=(const MessageCompressor&) = delete;
+
+			// Compresses msg's body in place if it is at least COMPRESSION_THRESHOLD long and comes
+			// out smaller, and re-encodes its header. Returns true if it did.
+			bool Compress(ServerMessage& msg);
+		private:
+			z_stream stream;
+			bool initialized{ false };
+			char scratch[ServerMessage::max_body_length];
+		};
+
+		// The other end of MessageCompressor. Also one per connection and not thread safe.
+		class MessageDecompressor {
+		public:
+			MessageDecompressor();
+			~MessageDecompressor();
+			MessageDecompressor(const MessageDecompressor&) = delete;
+			MessageDecompressor& operator=(const MessageDecompressor&) = delete;
+
+			// Decompresses msg's body in place if it is compressed. Returns false if it is
+			// corrupt or would be longer than max_body_length.
+			bool Decompress(ServerMessage& msg);
+		private:
+			z_stream stream;
+			bool initialized{ false };
+			char scratch[ServerMessage::max_body_length];
+		};
+	}
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+/**
+ * Lock-free multiple producer, single consumer queue
+ */
+
+#include <atomic>
+#include <utility>
+
+namespace tec {
+	template <class T>
+	class MPSCQueue {
+	public:
+		MPSCQueue() = default;
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+		~MPSCQueue() {
+			Node* node = this->head.exchange(nullptr);
+			while (node) {
+				Node* next = node->next;
+				delete node;
+				node = next;
+			}
+		}
+
+		/**
+		 * Adds an element. Safe to call from any number of threads
+		 */
+		void Push(T value) {
+			Node* node = new Node{ std::move(value), this->head.load(std::memory_order_relaxed) };
+			while (!this->head.compare_exchange_weak(node->next, node,
+				std::memory_order_release, std::memory_order_relaxed)) {
+			}
+		}
+
+		/**
+		 * Removes every element pushed so far and passes them to func in the order they were
+		 * pushed. Only one thread may consume at a time. Returns the number of elements consumed
+		 */
+		template <class F>
+		std::size_t ConsumeAll(F&& func) {
+			Node* node = this->head.exchange(nullptr, std::memory_order_acquire);
+			// The stack holds the newest element first so reverse it to get FIFO order.
+			Node* fifo = nullptr;
+			while (node) {
+				Node* next = node->next;
+				node->next = fifo;
+				fifo = node;
+				node = next;
+			}
+			std::size_t count = 0;
+			while (fifo) {
+				Node* next = fifo->next;
+				func(std::move(fifo->value));
+				delete fifo;
+				fifo = next;
+				++count;
+			}
+			return count;
+		}
+
+		/**
+		 * Returns true if there is not any element stored
+		 */
+		bool empty() const {
+			return this->head.load(std::memory_order_acquire) == nullptr;
+		}
+
+	private:
+		struct Node {
+			T value;
+			Node* next;
+		};
+
+		std::atomic<Node*> head{ nullptr }; /// Most recently pushed element
+	};
+}
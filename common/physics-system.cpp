@@ -3,6 +3,8 @@
 
 #include "physics-system.hpp"
 
+#include <algorithm>
+
 // #include "physics/physics-debug-drawer.hpp"
 #include <BulletCollision/Gimpact/btGImpactShape.h>
 #include <BulletCollision/Gimpact/btGImpactCollisionAlgorithm.h>
@@ -256,6 +258,98 @@ namespace tec {
 		return 0;
 	}
 
+	eid PhysicsSystem::RayCast(const glm::vec3& from, const glm::vec3& to, eid ignore, glm::vec3* hit_point) {
+		btVector3 ray_from(from.x, from.y, from.z), ray_to(to.x, to.y, to.z);
+		btDynamicsWorld::AllHitsRayResultCallback ray_result_callback(ray_from, ray_to);
+		this->dynamicsWorld->rayTest(ray_from, ray_to, ray_result_callback);
+		if (!ray_result_callback.hasHit()) {
+			return 0;
+		}
+		double lastfrac = 1.1;
+		int hit_index = -1;
+		eid hit_entity = 0;
+		for (int i = 0; i < ray_result_callback.m_collisionObjects.size(); i++) {
+			const CollisionBody* colbody = (const CollisionBody*)ray_result_callback.m_collisionObjects.at(i)->getUserPointer();
+			if (!colbody || !colbody->entity_id || colbody->entity_id == ignore) {
+				continue;
+			}
+			double frc = ray_result_callback.m_hitFractions.at(i);
+			if (frc < lastfrac) {
+				hit_entity = colbody->entity_id;
+				hit_index = i;
+				lastfrac = frc;
+			}
+		}
+		if (hit_point && hit_index >= 0) {
+			const btVector3& point = ray_result_callback.m_hitPointWorld.at(hit_index);
+			*hit_point = glm::vec3(point.getX(), point.getY(), point.getZ());
+		}
+		return hit_entity;
+	}
+
+	void PhysicsSystem::Overlap(const glm::vec3& center, float radius, eid ignore, std::vector<eid>& out) {
+		struct OverlapCallback : btCollisionWorld::ContactResultCallback {
+			OverlapCallback(eid ignore, std::vector<eid>& out) : ignore(ignore), out(out) { }
+
+			btScalar addSingleResult(btManifoldPoint&, const btCollisionObjectWrapper*, int, int,
+				const btCollisionObjectWrapper* other, int, int) override {
+				const CollisionBody* colbody = (const CollisionBody*)other->getCollisionObject()->getUserPointer();
+				if (colbody && colbody->entity_id && colbody->entity_id != this->ignore &&
+					std::find(this->out.begin(), this->out.end(), colbody->entity_id) == this->out.end()) {
+					this->out.push_back(colbody->entity_id);
+				}
+				return 0;
+			}
+
+			eid ignore;
+			std::vector<eid>& out;
+		};
+		btSphereShape sphere(radius);
+		btCollisionObject query;
+		query.setCollisionShape(&sphere);
+		query.setWorldTransform(btTransform(btQuaternion::getIdentity(), btVector3(center.x, center.y, center.z)));
+		OverlapCallback callback(ignore, out);
+		this->dynamicsWorld->contactTest(&query, callback);
+	}
+
+	bool PhysicsSystem::GetBodyTransform(eid entity_id, glm::vec3& position, glm::quat& orientation) const {
+		if (!HasBody(entity_id)) {
+			return false;
+		}
+		const btTransform& transform = this->bodies.at(entity_id)->getWorldTransform();
+		const btVector3& origin = transform.getOrigin();
+		const btQuaternion rotation = transform.getRotation();
+		position = glm::vec3(origin.x(), origin.y(), origin.z());
+		orientation = glm::quat(rotation.w(), rotation.x(), rotation.y(), rotation.z());
+		return true;
+	}
+
+	float PhysicsSystem::GetBodyRadius(eid entity_id) const {
+		if (!HasBody(entity_id)) {
+			return 0.0f;
+		}
+		const btCollisionShape* shape = this->bodies.at(entity_id)->getCollisionShape();
+		if (!shape) {
+			return 0.0f;
+		}
+		btVector3 center;
+		btScalar radius;
+		shape->getBoundingSphere(center, radius);
+		return static_cast<float>(radius + center.length());
+	}
+
+	bool PhysicsSystem::SetBodyTransform(eid entity_id, const glm::vec3& position, const glm::quat& orientation) {
+		if (!HasBody(entity_id)) {
+			return false;
+		}
+		btRigidBody* body = this->bodies.at(entity_id);
+		body->setWorldTransform(btTransform(btQuaternion(orientation.x, orientation.y, orientation.z, orientation.w),
+			btVector3(position.x, position.y, position.z)));
+		// Queries go through the broadphase, so it has to see the move too.
+		this->dynamicsWorld->updateSingleAabb(body);
+		return true;
+	}
+
 	void PhysicsSystem::DebugDraw() {
 		this->dynamicsWorld->debugDrawWorld();
 
@@ -5,6 +5,7 @@
 
 #include <map>
 #include <memory>
+#include <vector>
 
 #include <btBulletDynamicsCommon.h>
 #include <glm/glm.hpp>
@@ -42,6 +43,27 @@ namespace tec {
 			last_rayvalid = false;
 		}
 
+		// Nearest entity whose body the segment from-to hits, other than ignore, or 0 if none.
+		eid RayCast(const glm::vec3& from, const glm::vec3& to, eid ignore, glm::vec3* hit_point = nullptr);
+
+		// Appends the entities whose bodies touch the sphere, other than ignore.
+		void Overlap(const glm::vec3& center, float radius, eid ignore, std::vector<eid>& out);
+
+		bool HasBody(eid entity_id) const {
+			auto body = this->bodies.find(entity_id);
+			return body != this->bodies.end() && body->second;
+		}
+
+		// Where entity_id's body is in the collision world. Returns false if it has no body.
+		bool GetBodyTransform(eid entity_id, glm::vec3& position, glm::quat& orientation) const;
+
+		// Radius of a sphere about entity_id's body origin its shape fits in, or 0 if it has no body.
+		float GetBodyRadius(eid entity_id) const;
+
+		// Moves entity_id's body in the collision world without simulating it, e.g. to rewind it
+		// for a query. Returns false if it has no body.
+		bool SetBodyTransform(eid entity_id, const glm::vec3& position, const glm::quat& orientation);
+
 		void DebugDraw();
 		void On(std::shared_ptr<MouseBtnEvent> data);
 		void On(std::shared_ptr<EntityCreated> data);
@@ -0,0 +1,64 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "quantization.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tec {
+	QuantizationSettings REPLICATION_QUANTIZATION;
+
+	// Largest magnitude of the three smallest components of a unit quaternion.
+	static const float SMALLEST_THREE_RANGE = 0.70710678f;
+
+	// Worked out in double, as a float can't hold every step past 24 bits.
+	static double GetSteps(unsigned int bits) {
+		return static_cast<double>(BitWriter::Mask(std::min(std::max(bits, 1u), MAX_QUANTIZATION_BITS)));
+	}
+
+	std::uint32_t QuantizeFloat(float value, float min, float max, unsigned int bits) {
+		const double normalized = std::min(std::max((static_cast<double>(value) - min) / (static_cast<double>(max) - min), 0.0), 1.0);
+		return static_cast<std::uint32_t>(std::llround(normalized * GetSteps(bits)));
+	}
+
+	float DequantizeFloat(std::uint32_t value, float min, float max, unsigned int bits) {
+		const double steps = GetSteps(bits);
+		return static_cast<float>(min + (std::min(static_cast<double>(value), steps) / steps) * (static_cast<double>(max) - min));
+	}
+
+	QuantizedQuat QuantizeQuat(const glm::quat& q, unsigned int bits) {
+		const float components[4] = { q.x, q.y, q.z, q.w };
+		QuantizedQuat result;
+		for (std::uint32_t i = 1; i < 4; ++i) {
+			if (std::abs(components[i]) > std::abs(components[result.largest])) {
+				result.largest = i;
+			}
+		}
+		// q and -q are the same rotation, so flip it to make the dropped component positive.
+		const float sign = components[result.largest] < 0.0f ? -1.0f : 1.0f;
+		std::uint32_t* smallest[3] = { &result.a, &result.b, &result.c };
+		for (std::uint32_t i = 0, j = 0; i < 4; ++i) {
+			if (i != result.largest) {
+				*smallest[j++] = QuantizeFloat(components[i] * sign, -SMALLEST_THREE_RANGE, SMALLEST_THREE_RANGE, bits);
+			}
+		}
+		return result;
+	}
+
+	glm::quat DequantizeQuat(const QuantizedQuat& q, unsigned int bits) {
+		const std::uint32_t smallest[3] = { q.a, q.b, q.c };
+		float components[4];
+		float sum_squares = 0.0f;
+		for (std::uint32_t i = 0, j = 0; i < 4; ++i) {
+			if (i != q.largest) {
+				components[i] = DequantizeFloat(smallest[j++], -SMALLEST_THREE_RANGE, SMALLEST_THREE_RANGE, bits);
+				sum_squares += components[i] * components[i];
+			}
+		}
+		components[q.largest] = std::sqrt(std::max(0.0f, 1.0f - sum_squares));
+		// glm::quat's constructor takes w first. Not renormalized, so quantizing the result
+		// gives back the same values.
+		return glm::quat(components[3], components[0], components[1], components[2]);
+	}
+}
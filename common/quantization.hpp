@@ -0,0 +1,120 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace tec {
+	// Widest a quantized value may be. Wider bits settings are treated as this.
+	const unsigned int MAX_QUANTIZATION_BITS = 31;
+
+	// Precision transforms are replicated with. Server and client must agree on these, and each
+	// bits setting must be between 1 and MAX_QUANTIZATION_BITS.
+	struct QuantizationSettings {
+		float position_range = 4096.0f; // Positions are clamped to [-range, range] on each axis.
+		unsigned int position_bits = 20; // Per axis, ~8mm steps over the default range.
+		unsigned int orientation_bits = 10; // Per smallest-three component.
+		float velocity_range = 64.0f; // Linear and angular velocities are clamped to [-range, range].
+		unsigned int velocity_bits = 12; // Per axis.
+	};
+
+	extern QuantizationSettings REPLICATION_QUANTIZATION;
+
+	// Maps value, clamped to [min, max], onto the integers [0, 2^bits - 1]. bits is clamped to
+	// [1, MAX_QUANTIZATION_BITS].
+	std::uint32_t QuantizeFloat(float value, float min, float max, unsigned int bits);
+
+	float DequantizeFloat(std::uint32_t value, float min, float max, unsigned int bits);
+
+	// A unit quaternion stored as the index of its largest component and the other three,
+	// which all lie in [-1/sqrt(2), 1/sqrt(2)]. The largest is recovered as they're unit length.
+	struct QuantizedQuat {
+		std::uint32_t largest{ 0 };
+		std::uint32_t a{ 0 }, b{ 0 }, c{ 0 };
+
+		bool operator==(const QuantizedQuat& other) const {
+			return largest == other.largest && a == other.a && b == other.b && c == other.c;
+		}
+		bool operator!=(const QuantizedQuat& other) const {
+			return !(*this == other);
+		}
+	};
+
+	QuantizedQuat QuantizeQuat(const glm::quat& q, unsigned int bits);
+
+	glm::quat DequantizeQuat(const QuantizedQuat& q, unsigned int bits);
+
+	// Packs values of any width up to 32 bits, least significant bit first, onto the end of a string.
+	class BitWriter {
+	public:
+		BitWriter(std::string& out) : out(out) { }
+
+		~BitWriter() {
+			Flush();
+		}
+
+		void Write(std::uint32_t value, unsigned int bits) {
+			this->scratch |= static_cast<std::uint64_t>(value & Mask(bits)) << this->scratch_bits;
+			this->scratch_bits += bits;
+			while (this->scratch_bits >= 8) {
+				this->out.push_back(static_cast<char>(this->scratch & 0xff));
+				this->scratch >>= 8;
+				this->scratch_bits -= 8;
+			}
+		}
+
+		// Pads to the next whole byte.
+		void Flush() {
+			if (this->scratch_bits > 0) {
+				this->out.push_back(static_cast<char>(this->scratch & 0xff));
+			}
+			this->scratch = 0;
+			this->scratch_bits = 0;
+		}
+
+		static std::uint32_t Mask(unsigned int bits) {
+			return bits >= 32 ? 0xffffffffu : ((1u << bits) - 1);
+		}
+	private:
+		std::string& out;
+		std::uint64_t scratch{ 0 };
+		unsigned int scratch_bits{ 0 };
+	};
+
+	// Reads what a BitWriter wrote. Never reads past size; a read that would fails instead.
+	class BitReader {
+	public:
+		BitReader(const char* data, std::size_t size, std::size_t& pos) : data(data), size(size), pos(pos) { }
+
+		bool Read(std::uint32_t& value, unsigned int bits) {
+			while (this->scratch_bits < bits) {
+				if (this->pos >= this->size) {
+					return false;
+				}
+				this->scratch |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(this->data[this->pos++])) << this->scratch_bits;
+				this->scratch_bits += 8;
+			}
+			value = static_cast<std::uint32_t>(this->scratch & BitWriter::Mask(bits));
+			this->scratch >>= bits;
+			this->scratch_bits -= bits;
+			return true;
+		}
+
+		// Skips the padding up to the next whole byte.
+		void Align() {
+			this->scratch = 0;
+			this->scratch_bits = 0;
+		}
+	private:
+		const char* data;
+		std::size_t size;
+		std::size_t& pos;
+		std::uint64_t scratch{ 0 };
+		unsigned int scratch_bits{ 0 };
+	};
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+/**
+ * Reusable buffer that socket reads go straight into, and that ServerMessages are framed
+ * out of. One read can fill it with any number of messages (or part of one).
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "server-message.hpp"
+
+namespace tec {
+	namespace networking {
+		class ReceiveBuffer {
+		public:
+			enum class Result {
+				MESSAGE, // A complete message was extracted.
+				INCOMPLETE, // More data needs to be read first.
+				INVALID, // The next header is malformed, the stream can't be recovered.
+			};
+
+			/**
+			 * capacity must be able to hold at least one full message
+			 */
+			ReceiveBuffer(std::size_t capacity = 16 * (ServerMessage::header_length + ServerMessage::max_body_length)) :
+				buffer(capacity) { }
+
+			/**
+			 * Where the next read should write to
+			 */
+			char* GetWritePTR() {
+				return this->buffer.data() + this->end;
+			}
+
+			/**
+			 * How many bytes the next read may write
+			 */
+			std::size_t GetWriteSpace() const {
+				return this->buffer.size() - this->end;
+			}
+
+			/**
+			 * Marks length bytes after GetWritePTR() as read from the socket
+			 */
+			void Commit(std::size_t length) {
+				this->end += length;
+			}
+
+			/**
+			 * Copies the next complete message into msg
+			 */
+			Result Next(ServerMessage& msg) {
+				const std::size_t available = this->end - this->begin;
+				if (available < ServerMessage::header_length) {
+					Compact();
+					return Result::INCOMPLETE;
+				}
+				std::memcpy(msg.GetDataPTR(), this->buffer.data() + this->begin, ServerMessage::header_length);
+				if (!msg.decode_header()) {
+					return Result::INVALID;
+				}
+				if (available < msg.length()) {
+					Compact();
+					return Result::INCOMPLETE;
+				}
+				std::memcpy(msg.GetBodyPTR(), this->buffer.data() + this->begin + ServerMessage::header_length,
+					msg.GetBodyLength());
+				this->begin += msg.length();
+				return Result::MESSAGE;
+			}
+
+			/**
+			 * Drops everything buffered, used when a connection is reset
+			 */
+			void Clear() {
+				this->begin = 0;
+				this->end = 0;
+			}
+
+		private:
+			// Moves a trailing partial message to the front so the next read has room.
+			void Compact() {
+				if (this->begin > 0) {
+					std::memmove(this->buffer.data(), this->buffer.data() + this->begin, this->end - this->begin);
+					this->end -= this->begin;
+					this->begin = 0;
+				}
+			}
+
+			std::vector<char> buffer;
+			std::size_t begin = 0; /// Start of the first unconsumed byte
+			std::size_t end = 0; /// One past the last byte read
+		};
+	}
+}
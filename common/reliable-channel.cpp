@@ -0,0 +1,260 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "reliable-channel.hpp"
+
+#include <cstring>
+
+namespace tec {
+	namespace networking {
+		ReliableChannel::clock::duration ReliableChannel::resend_interval = std::chrono::milliseconds(100);
+		ReliableChannel::clock::duration ReliableChannel::ack_timeout = std::chrono::seconds(5);
+
+		enum : std::uint8_t { UNRELIABLE_ENTRY = 0, RELIABLE_ENTRY = 1 };
+
+		static void Write16(char* buffer, std::size_t& pos, std::uint16_t value) {
+			buffer[pos++] = static_cast<char>(value & 0xff);
+			buffer[pos++] = static_cast<char>((value >> 8) & 0xff);
+		}
+
+		static void Write32(char* buffer, std::size_t& pos, std::uint32_t value) {
+			Write16(buffer, pos, static_cast<std::uint16_t>(value & 0xffff));
+			Write16(buffer, pos, static_cast<std::uint16_t>(value >> 16));
+		}
+
+		static std::uint16_t Read16(const char* data, std::size_t& pos) {
+			std::uint16_t value = static_cast<std::uint8_t>(data[pos]) |
+				(static_cast<std::uint8_t>(data[pos + 1]) << 8);
+			pos += 2;
+			return value;
+		}
+
+		static std::uint32_t Read32(const char* data, std::size_t& pos) {
+			std::uint32_t low = Read16(data, pos);
+			std::uint32_t high = Read16(data, pos);
+			return low | (high << 16);
+		}
+
+		Reliability GetReliability(MessageType type) {
+			switch (type) {
+				case MessageType::GAME_STATE_UPDATE: // Superseded by the next one anyway.
+				case MessageType::CLIENT_COMMAND:
+				case MessageType::SYNC:
+				return Reliability::UNRELIABLE_LATEST;
+				default:
+				return Reliability::RELIABLE_ORDERED;
+			}
+		}
+
+		bool ReliableChannel::PeekConnectionID(const char* data, std::size_t size, std::uint32_t& connection_id) {
+			if (size < header_length) {
+				return false;
+			}
+			std::size_t pos = 0;
+			connection_id = Read32(data, pos);
+			return true;
+		}
+
+		bool ReliableChannel::Queue(const ServerMessage& msg) {
+			if (GetReliability(msg.GetMessageType()) == Reliability::RELIABLE_ORDERED) {
+				if (this->pending_reliable.size() >= max_pending_reliable) {
+					return false;
+				}
+				PendingReliable pending;
+				pending.reliable_id = this->next_reliable_id++;
+				pending.msg = msg;
+				this->pending_reliable.push_back(std::move(pending));
+			}
+			else {
+				this->latest_unreliable[msg.GetMessageType()] = msg;
+			}
+			return true;
+		}
+
+		bool ReliableChannel::IsStalled(clock::time_point now) const {
+			if (this->pending_reliable.size() >= max_pending_reliable) {
+				return true;
+			}
+			// Acked messages are removed, so the front is the one waiting longest.
+			return !this->pending_reliable.empty() && this->pending_reliable.front().sent &&
+				now - this->pending_reliable.front().first_sent >= ack_timeout;
+		}
+
+		bool ReliableChannel::HasPending(clock::time_point now) const {
+			if (!this->latest_unreliable.empty()) {
+				return true;
+			}
+			for (const PendingReliable& pending : this->pending_reliable) {
+				if (!pending.sent || now - pending.last_sent >= resend_interval) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		std::size_t ReliableChannel::WritePacket(char* buffer, std::size_t size, clock::time_point now) {
+			if (size < header_length) {
+				return 0;
+			}
+			const sequence_t sequence = this->local_sequence++;
+			if (this->local_sequence == 0) {
+				this->local_sequence = 1;
+			}
+			SentPacket& sent = this->sent_packets[sequence % sent_packets_size];
+			sent.valid = true;
+			sent.sequence = sequence;
+			sent.reliable_ids.clear();
+
+			std::size_t pos = 0;
+			Write32(buffer, pos, this->connection_id);
+			Write16(buffer, pos, sequence);
+			Write16(buffer, pos, this->remote_sequence);
+			Write32(buffer, pos, this->received_bits);
+
+			// Oldest reliable messages first so a full datagram doesn't starve them.
+			for (PendingReliable& pending : this->pending_reliable) {
+				if (pending.sent && now - pending.last_sent < resend_interval) {
+					continue;
+				}
+				if (pos + 3 + pending.msg.length() > size) {
+					break;
+				}
+				buffer[pos++] = static_cast<char>(RELIABLE_ENTRY);
+				Write16(buffer, pos, pending.reliable_id);
+				std::memcpy(buffer + pos, pending.msg.GetDataPTR(), pending.msg.length());
+				pos += pending.msg.length();
+				if (!pending.sent) {
+					pending.first_sent = now;
+				}
+				pending.sent = true;
+				pending.last_sent = now;
+				sent.reliable_ids.push_back(pending.reliable_id);
+			}
+			for (auto itr = this->latest_unreliable.begin(); itr != this->latest_unreliable.end(); ) {
+				if (pos + 1 + itr->second.length() > size) {
+					++itr;
+					continue;
+				}
+				buffer[pos++] = static_cast<char>(UNRELIABLE_ENTRY);
+				std::memcpy(buffer + pos, itr->second.GetDataPTR(), itr->second.length());
+				pos += itr->second.length();
+				itr = this->latest_unreliable.erase(itr);
+			}
+			return pos;
+		}
+
+		void ReliableChannel::ProcessAck(sequence_t sequence) {
+			SentPacket& sent = this->sent_packets[sequence % sent_packets_size];
+			if (!sent.valid || sent.sequence != sequence) {
+				return;
+			}
+			sent.valid = false;
+			for (sequence_t reliable_id : sent.reliable_ids) {
+				for (auto itr = this->pending_reliable.begin(); itr != this->pending_reliable.end(); ++itr) {
+					if (itr->reliable_id == reliable_id) {
+						this->pending_reliable.erase(itr);
+						break;
+					}
+				}
+			}
+		}
+
+		bool ReliableChannel::ReadPacket(const char* data, std::size_t size,
+			const std::function<void(ServerMessage&)>& handler) {
+			if (size < header_length) {
+				return false;
+			}
+			std::size_t pos = 0;
+			if (Read32(data, pos) != this->connection_id) {
+				return false;
+			}
+			const sequence_t sequence = Read16(data, pos);
+			const sequence_t ack = Read16(data, pos);
+			const std::uint32_t ack_bits = Read32(data, pos);
+
+			// Track what we've received so it can be acked back.
+			if (!this->received_any) {
+				this->received_any = true;
+				this->remote_sequence = sequence;
+				this->received_bits = 0;
+			}
+			else if (SequenceGreaterThan(sequence, this->remote_sequence)) {
+				const sequence_t shift = sequence - this->remote_sequence;
+				std::uint32_t bits = shift < 32 ? this->received_bits << shift : 0;
+				if (shift <= 32) {
+					bits |= 1u << (shift - 1); // The previous newest sequence.
+				}
+				this->received_bits = bits;
+				this->remote_sequence = sequence;
+			}
+			else {
+				const sequence_t age = this->remote_sequence - sequence;
+				if (age == 0) {
+					return true; // Duplicate datagram.
+				}
+				if (age <= 32) {
+					const std::uint32_t bit = 1u << (age - 1);
+					if (this->received_bits & bit) {
+						return true; // Duplicate datagram.
+					}
+					this->received_bits |= bit;
+				}
+			}
+
+			ProcessAck(ack);
+			for (sequence_t i = 0; i < 32; ++i) {
+				if (ack_bits & (1u << i)) {
+					ProcessAck(static_cast<sequence_t>(ack - 1 - i));
+				}
+			}
+
+			ServerMessage msg;
+			while (pos < size) {
+				const std::uint8_t entry_type = static_cast<std::uint8_t>(data[pos++]);
+				sequence_t reliable_id = 0;
+				if (entry_type == RELIABLE_ENTRY) {
+					if (pos + 2 > size) {
+						return false;
+					}
+					reliable_id = Read16(data, pos);
+				}
+				if (pos + ServerMessage::header_length > size) {
+					return false;
+				}
+				std::memcpy(msg.GetDataPTR(), data + pos, ServerMessage::header_length);
+				if (!msg.decode_header() || pos + msg.length() > size) {
+					return false;
+				}
+				std::memcpy(msg.GetBodyPTR(), data + pos + ServerMessage::header_length, msg.GetBodyLength());
+				pos += msg.length();
+
+				if (entry_type == RELIABLE_ENTRY) {
+					if (reliable_id == this->expected_reliable_id) {
+						handler(msg);
+						++this->expected_reliable_id;
+						// Deliver anything that was waiting on this one.
+						auto next = this->buffered_reliable.find(this->expected_reliable_id);
+						while (next != this->buffered_reliable.end()) {
+							handler(next->second);
+							this->buffered_reliable.erase(next);
+							next = this->buffered_reliable.find(++this->expected_reliable_id);
+						}
+					}
+					else if (SequenceGreaterThan(reliable_id, this->expected_reliable_id) &&
+						this->buffered_reliable.size() < max_buffered_reliable) {
+						this->buffered_reliable.emplace(reliable_id, msg);
+					}
+					// Otherwise it's a resend of something already delivered.
+				}
+				else {
+					auto latest = this->latest_unreliable_sequence.find(msg.GetMessageType());
+					if (latest == this->latest_unreliable_sequence.end() || SequenceGreaterThan(sequence, latest->second)) {
+						this->latest_unreliable_sequence[msg.GetMessageType()] = sequence;
+						handler(msg);
+					}
+				}
+			}
+			return true;
+		}
+	}
+}
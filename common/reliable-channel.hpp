@@ -0,0 +1,124 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "server-message.hpp"
+
+namespace tec {
+	namespace networking {
+		typedef std::uint16_t sequence_t;
+
+		enum class Reliability {
+			UNRELIABLE_LATEST, // Sent once. Only the newest message of each type is kept or delivered.
+			RELIABLE_ORDERED, // Resent until acked, delivered exactly once and in order.
+		};
+
+		// Which reliability class each message type is sent with over UDP.
+		Reliability GetReliability(MessageType type);
+
+		// Returns true if sequence a is more recent than b, allowing for wrap around.
+		inline bool SequenceGreaterThan(sequence_t a, sequence_t b) {
+			return ((a > b) && (a - b <= 32768)) || ((a < b) && (b - a > 32768));
+		}
+
+		// Reliability layer for carrying ServerMessages over datagrams. Each datagram is
+		// laid out (little endian) as:
+		//   u32 connection_id, u16 sequence, u16 ack, u32 ack_bits
+		// followed by any number of entries of:
+		//   u8 reliability, [u16 reliable_id, only for reliable], ServerMessage header and body
+		// ack is the newest sequence received from the other side and bit n of ack_bits
+		// acks sequence (ack - 1 - n). Reliable messages are resent in later datagrams until
+		// a datagram carrying them is acked. The channel does no I/O itself.
+		class ReliableChannel {
+		public:
+			typedef std::chrono::steady_clock clock;
+			enum { header_length = 12 };
+			enum { max_packet_size = 1200 };
+
+			ReliableChannel(std::uint32_t connection_id = 0) : connection_id(connection_id) { }
+
+			void SetConnectionID(std::uint32_t id) {
+				this->connection_id = id;
+			}
+
+			std::uint32_t GetConnectionID() const {
+				return this->connection_id;
+			}
+
+			// Reads the connection id of a datagram so it can be routed to its channel.
+			static bool PeekConnectionID(const char* data, std::size_t size, std::uint32_t& connection_id);
+
+			// Queues a message to go out in the next datagram(s), with the reliability its type calls
+			// for. Returns false, queuing nothing, if max_pending_reliable reliable messages are
+			// already waiting to be acked.
+			bool Queue(const ServerMessage& msg);
+
+			// Returns true if the other side has stopped acking: the reliable queue is full, or its
+			// oldest message has gone unacked for ack_timeout. Resending can't help by then, and
+			// reliable ids would soon wrap into ones the receiver takes for resends.
+			bool IsStalled(clock::time_point now = clock::now()) const;
+
+			// Returns true if there is anything that the next WritePacket would send.
+			bool HasPending(clock::time_point now = clock::now()) const;
+
+			// Writes the next datagram into buffer (at most size bytes) and returns its length.
+			// Always writes at least a header, so calling this keeps acks flowing.
+			std::size_t WritePacket(char* buffer, std::size_t size, clock::time_point now = clock::now());
+
+			// Handles a received datagram, calling handler for each message that is ready to be
+			// delivered. Returns false if the datagram is malformed or for another connection.
+			bool ReadPacket(const char* data, std::size_t size, const std::function<void(ServerMessage&)>& handler);
+
+			// How long to wait for an ack before sending a reliable message again.
+			static clock::duration resend_interval;
+
+			// How long a reliable message may go unacked before the channel counts as stalled.
+			static clock::duration ack_timeout;
+
+			// Most reliable messages waiting to be acked, as many as the receiver buffers.
+			enum { max_pending_reliable = 1024 };
+		private:
+			void ProcessAck(sequence_t sequence);
+
+			struct PendingReliable {
+				sequence_t reliable_id;
+				ServerMessage msg;
+				bool sent{ false };
+				clock::time_point first_sent, last_sent;
+			};
+
+			struct SentPacket {
+				bool valid{ false };
+				sequence_t sequence{ 0 };
+				std::vector<sequence_t> reliable_ids;
+			};
+			enum { sent_packets_size = 256 };
+			enum { max_buffered_reliable = 1024 };
+
+			std::uint32_t connection_id;
+
+			// Outgoing
+			sequence_t local_sequence{ 1 }; // 0 is never sent, it means "nothing received" in acks.
+			sequence_t next_reliable_id{ 0 };
+			std::deque<PendingReliable> pending_reliable;
+			std::map<MessageType, ServerMessage> latest_unreliable;
+			SentPacket sent_packets[sent_packets_size];
+
+			// Incoming
+			bool received_any{ false };
+			sequence_t remote_sequence{ 0 };
+			std::uint32_t received_bits{ 0 };
+			sequence_t expected_reliable_id{ 0 };
+			std::map<sequence_t, ServerMessage> buffered_reliable; // Arrived ahead of expected_reliable_id.
+			std::map<MessageType, sequence_t> latest_unreliable_sequence;
+		};
+	}
+}
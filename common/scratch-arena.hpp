@@ -0,0 +1,53 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <google/protobuf/arena.h>
+
+namespace tec {
+	// A protobuf arena for messages that only live until the next Reset, such as one tick's
+	// updates or one received message. Its first block is owned here and kept across resets,
+	// so once a use fits in it messages are built without touching the heap. Anything that
+	// overflows the block is freed on Reset.
+	class ScratchArena {
+	public:
+		explicit ScratchArena(std::size_t block_size = 64 * 1024) :
+			block(block_size), arena(MakeOptions(this->block)) { }
+
+		ScratchArena(const ScratchArena&) = delete;
+		ScratchArena& operator=(const ScratchArena&) = delete;
+
+		template <typename T>
+		T* Create() {
+			return google::protobuf::Arena::CreateMessage<T>(&this->arena);
+		}
+
+		// Destroys everything created since the last reset.
+		void Reset() {
+			this->arena.Reset();
+		}
+
+		// Bytes currently held, including the owned block.
+		std::size_t GetSpaceAllocated() const {
+			return static_cast<std::size_t>(this->arena.SpaceAllocated());
+		}
+
+		std::size_t GetBlockSize() const {
+			return this->block.size();
+		}
+	private:
+		static google::protobuf::ArenaOptions MakeOptions(std::vector<char>& block) {
+			google::protobuf::ArenaOptions options;
+			options.initial_block = block.data();
+			options.initial_block_size = block.size();
+			return options;
+		}
+
+		std::vector<char> block; // Must be declared before arena.
+		google::protobuf::Arena arena;
+	};
+}
@@ -22,13 +22,20 @@ namespace tec {
 			CLIENT_ID,
 			CLIENT_LEAVE,
 			GAME_STATE_UPDATE,
-			CHAT_MESSAGE
+			CHAT_MESSAGE,
+			UDP_HANDSHAKE, // Sent over TCP, carries the connection id to use for the UDP channel.
+			// Client to server: the codecs it can decompress, comma separated. Server to client: the
+			// one picked, or an empty body for none.
+			COMPRESSION,
+			// Client to server: an empty request. Server to client: the tick profile, as text.
+			SERVER_STATS,
 		};
 
 		class ServerMessage {
 		public:
 			enum { header_length = 16 };
 			enum { max_body_length = 512 };
+			enum { compressed_flag = 0x100 }; // Or'd into the type in the header when the body is compressed.
 
 			ServerMessage() : body_length(0), last_recv_state_id(0),
 				message_type(MessageType::CHAT_MESSAGE) { }
@@ -69,10 +76,19 @@ namespace tec {
 				this->message_type = value;
 			}
 
-			MessageType GetMessageType() {
+			MessageType GetMessageType() const {
 				return this->message_type;
 			}
 
+			// Whether the body is compressed with the connection's codec.
+			bool IsCompressed() const {
+				return this->compressed;
+			}
+
+			void SetCompressed(bool value) {
+				this->compressed = value;
+			}
+
 			void SetBodyLength(std::size_t new_length) {
 				body_length = new_length;
 				if (body_length > max_body_length) {
@@ -86,7 +102,9 @@ namespace tec {
 				body_length = std::atoi(length_header);
 				char type_header[5] = "";
 				std::strncat(type_header, data + 4, 4);
-				message_type = static_cast<MessageType>(std::atoi(type_header));
+				const int type = std::atoi(type_header);
+				message_type = static_cast<MessageType>(type & ~compressed_flag);
+				compressed = (type & compressed_flag) != 0;
 				char state_id_header[9] = "";
 				std::strncat(state_id_header, data + 8, 8);
 				last_recv_state_id = static_cast<state_id_t>(std::atoi(state_id_header));
@@ -99,7 +117,8 @@ namespace tec {
 
 			void encode_header() {
 				char header[header_length + 1] = "";
-				std::sprintf(header, "%4zu%4d%" PRI_STATE_ID_T, body_length, message_type, last_recv_state_id);
+				std::sprintf(header, "%4zu%4d%" PRI_STATE_ID_T, body_length,
+					compressed ? (message_type | compressed_flag) : message_type, last_recv_state_id);
 				std::memcpy(data, header, header_length);
 			}
 
@@ -108,6 +127,7 @@ namespace tec {
 			std::size_t body_length;
 			state_id_t last_recv_state_id;
 			MessageType message_type;
+			bool compressed{ false };
 		};
 	}
 }
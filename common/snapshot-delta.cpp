@@ -0,0 +1,449 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "snapshot-delta.hpp"
+
+#include <cstring>
+
+namespace tec {
+	static void WriteCodes(BitWriter& writer, const glm::vec3& value, float range, unsigned int bits) {
+		for (int i = 0; i < 3; ++i) {
+			writer.Write(QuantizeFloat(value[i], -range, range, bits), bits);
+		}
+	}
+
+	static bool ReadCodes(BitReader& reader, std::uint32_t codes[3], unsigned int bits) {
+		for (int i = 0; i < 3; ++i) {
+			if (!reader.Read(codes[i], bits)) {
+				return false;
+			}
+		}
+		reader.Align();
+		return true;
+	}
+
+	static void WriteRawVec3(BitWriter& writer, const glm::vec3& value) {
+		for (int i = 0; i < 3; ++i) {
+			std::uint32_t bits;
+			std::memcpy(&bits, &value[i], sizeof(bits));
+			writer.Write(bits, 32);
+		}
+	}
+
+	static bool ReadRawVec3(BitReader& reader, glm::vec3& value) {
+		for (int i = 0; i < 3; ++i) {
+			std::uint32_t bits;
+			if (!reader.Read(bits, 32)) {
+				return false;
+			}
+			std::memcpy(&value[i], &bits, sizeof(bits));
+		}
+		return true;
+	}
+
+	static void WriteVarint(std::string& out, std::uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	static bool ReadVarint(const char* data, std::size_t size, std::size_t& pos, std::uint64_t& value) {
+		value = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7) {
+			if (pos >= size) {
+				return false;
+			}
+			const std::uint8_t byte = static_cast<std::uint8_t>(data[pos++]);
+			value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// One field of a serialized protobuf message. Length delimited fields point into the message.
+	struct WireField {
+		std::uint32_t number{ 0 };
+		std::uint32_t wire_type{ 0 };
+		std::uint64_t value{ 0 };
+		const char* data{ nullptr };
+		std::size_t length{ 0 };
+	};
+
+	enum : std::uint32_t { WIRE_VARINT = 0, WIRE_FIXED64 = 1, WIRE_LENGTH_DELIMITED = 2, WIRE_FIXED32 = 5 };
+
+	// Field numbers of GameStateUpdate, see game_state.proto.
+	enum : std::uint32_t {
+		GSU_STATE_ID = 1, GSU_COMMAND_ID = 2, GSU_ENTITY = 3,
+		GSU_BASELINE_STATE_ID = 4, GSU_REMOVED_ENTITY = 5, GSU_TRANSFORMS = 6,
+	};
+
+	static bool ReadWireField(const char* data, std::size_t size, std::size_t& pos, WireField& field) {
+		std::uint64_t tag;
+		if (!ReadVarint(data, size, pos, tag) || (tag >> 3) == 0 || (tag >> 3) > 0x1fffffff) {
+			return false;
+		}
+		field.number = static_cast<std::uint32_t>(tag >> 3);
+		field.wire_type = static_cast<std::uint32_t>(tag & 0x7);
+		switch (field.wire_type) {
+			case WIRE_VARINT:
+			return ReadVarint(data, size, pos, field.value);
+			case WIRE_FIXED64:
+			case WIRE_FIXED32:
+			{
+				const std::size_t length = field.wire_type == WIRE_FIXED64 ? 8 : 4;
+				if (size - pos < length) {
+					return false;
+				}
+				pos += length;
+				return true;
+			}
+			case WIRE_LENGTH_DELIMITED:
+			if (!ReadVarint(data, size, pos, field.value) || field.value > size - pos) {
+				return false;
+			}
+			field.data = data + pos;
+			field.length = static_cast<std::size_t>(field.value);
+			pos += field.length;
+			return true;
+			default:
+			return false; // Groups aren't used by any of our messages.
+		}
+	}
+
+	static void RemoveEntity(eid entity_id, GameState& state) {
+		state.positions.erase(entity_id);
+		state.orientations.erase(entity_id);
+		state.velocities.erase(entity_id);
+	}
+
+	static void ApplyEntity(const proto::Entity& entity, GameState& state) {
+		const eid entity_id = entity.id();
+		for (int i = 0; i < entity.components_size(); ++i) {
+			const proto::Component& comp = entity.components(i);
+			switch (comp.component_case()) {
+				case proto::Component::kPosition:
+				state.positions[entity_id].In(comp);
+				break;
+				case proto::Component::kOrientation:
+				state.orientations[entity_id].In(comp);
+				break;
+				case proto::Component::kVelocity:
+				state.velocities[entity_id].In(comp);
+				break;
+				default:
+				// intentionally not handling other cases.
+				break;
+			}
+		}
+	}
+
+	// Moves what writer packed into block, leaving scratch empty for the next one.
+	static void StoreBlock(BitWriter& writer, std::string& scratch, EncodedTransform& transform, int block) {
+		writer.Flush();
+		transform.present |= static_cast<std::uint8_t>(1 << block);
+		transform.sizes[block] = static_cast<std::uint8_t>(scratch.size());
+		std::memcpy(transform.blocks[block], scratch.data(), scratch.size());
+		scratch.clear();
+	}
+
+	void EncodeTransform(eid entity_id, const GameState& state, EncodedTransform& transform,
+		const QuantizationSettings& settings) {
+		transform.present = 0;
+		std::string scratch; // Blocks are short enough to never leave the small string buffer.
+		BitWriter writer(scratch);
+		auto pos = state.positions.find(entity_id);
+		if (pos != state.positions.end()) {
+			WriteCodes(writer, pos->second.value, settings.position_range, settings.position_bits);
+			StoreBlock(writer, scratch, transform, 0);
+			WriteRawVec3(writer, pos->second.center_offset);
+			StoreBlock(writer, scratch, transform, 4);
+		}
+		auto ori = state.orientations.find(entity_id);
+		if (ori != state.orientations.end()) {
+			const QuantizedQuat orientation = QuantizeQuat(ori->second.value, settings.orientation_bits);
+			writer.Write(orientation.largest, 2);
+			writer.Write(orientation.a, settings.orientation_bits);
+			writer.Write(orientation.b, settings.orientation_bits);
+			writer.Write(orientation.c, settings.orientation_bits);
+			StoreBlock(writer, scratch, transform, 1);
+			WriteRawVec3(writer, ori->second.rotation_offset);
+			StoreBlock(writer, scratch, transform, 5);
+		}
+		auto vel = state.velocities.find(entity_id);
+		if (vel != state.velocities.end()) {
+			WriteCodes(writer, glm::vec3(vel->second.linear), settings.velocity_range, settings.velocity_bits);
+			StoreBlock(writer, scratch, transform, 2);
+			WriteCodes(writer, glm::vec3(vel->second.angular), settings.velocity_range, settings.velocity_bits);
+			StoreBlock(writer, scratch, transform, 3);
+		}
+	}
+
+	void EncodeState(const GameState& state, EncodedState& out, const QuantizationSettings& settings) {
+		for (auto itr = out.begin(); itr != out.end(); ) {
+			if (state.positions.find(itr->first) == state.positions.end()) {
+				itr = out.erase(itr);
+			}
+			else {
+				++itr;
+			}
+		}
+		for (const auto& pos : state.positions) {
+			EncodeTransform(pos.first, state, out[pos.first], settings);
+		}
+	}
+
+	bool WriteTransformDelta(eid entity_id, const EncodedTransform& transform, const EncodedTransform* baseline,
+		std::string& out) {
+		std::uint8_t flags = 0;
+		for (int block = 0; block < EncodedTransform::block_count; ++block) {
+			const std::uint8_t bit = static_cast<std::uint8_t>(1 << block);
+			if (!(transform.present & bit)) {
+				continue;
+			}
+			if (baseline && (baseline->present & bit)) {
+				if (!transform.SameBlock(block, *baseline)) {
+					flags |= bit;
+				}
+			}
+			else if (bit == TRANSFORM_CENTER_OFFSET || bit == TRANSFORM_ROTATION_OFFSET) {
+				for (std::uint8_t i = 0; i < transform.sizes[block]; ++i) {
+					if (transform.blocks[block][i] != 0) {
+						flags |= bit;
+						break;
+					}
+				}
+			}
+			else {
+				flags |= bit;
+			}
+		}
+		if (flags == 0) {
+			return false;
+		}
+		WriteVarint(out, entity_id);
+		out.push_back(static_cast<char>(flags));
+		for (int block = 0; block < EncodedTransform::block_count; ++block) {
+			if (flags & (1 << block)) {
+				out.append(transform.blocks[block], transform.sizes[block]);
+			}
+		}
+		return true;
+	}
+
+	bool WriteTransformDelta(eid entity_id, const GameState& baseline, const GameState& state, std::string& out,
+		const QuantizationSettings& settings) {
+		EncodedTransform transform, base;
+		EncodeTransform(entity_id, state, transform, settings);
+		EncodeTransform(entity_id, baseline, base, settings);
+		return WriteTransformDelta(entity_id, transform, &base, out);
+	}
+
+	bool ReadTransformFragment(const char* data, std::size_t size, std::size_t& pos, GameState& state,
+		const QuantizationSettings& settings) {
+		std::uint64_t entity_id;
+		if (!ReadVarint(data, size, pos, entity_id) || pos >= size) {
+			return false;
+		}
+		const std::uint8_t flags = static_cast<std::uint8_t>(data[pos++]);
+		BitReader reader(data, size, pos);
+		std::uint32_t codes[3];
+		if (flags & TRANSFORM_POSITION) {
+			if (!ReadCodes(reader, codes, settings.position_bits)) {
+				return false;
+			}
+			glm::vec3& value = state.positions[entity_id].value;
+			for (int i = 0; i < 3; ++i) {
+				value[i] = DequantizeFloat(codes[i], -settings.position_range, settings.position_range, settings.position_bits);
+			}
+		}
+		if (flags & TRANSFORM_ORIENTATION) {
+			QuantizedQuat orientation;
+			if (!reader.Read(orientation.largest, 2) || !ReadCodes(reader, codes, settings.orientation_bits)) {
+				return false;
+			}
+			orientation.a = codes[0];
+			orientation.b = codes[1];
+			orientation.c = codes[2];
+			Orientation& value = state.orientations[entity_id];
+			value.value = DequantizeQuat(orientation, settings.orientation_bits);
+			value.rotation = glm::eulerAngles(value.value);
+		}
+		if (flags & TRANSFORM_LINEAR_VELOCITY) {
+			if (!ReadCodes(reader, codes, settings.velocity_bits)) {
+				return false;
+			}
+			glm::vec4& value = state.velocities[entity_id].linear;
+			for (int i = 0; i < 3; ++i) {
+				value[i] = DequantizeFloat(codes[i], -settings.velocity_range, settings.velocity_range, settings.velocity_bits);
+			}
+		}
+		if (flags & TRANSFORM_ANGULAR_VELOCITY) {
+			if (!ReadCodes(reader, codes, settings.velocity_bits)) {
+				return false;
+			}
+			glm::vec4& value = state.velocities[entity_id].angular;
+			for (int i = 0; i < 3; ++i) {
+				value[i] = DequantizeFloat(codes[i], -settings.velocity_range, settings.velocity_range, settings.velocity_bits);
+			}
+		}
+		if (flags & TRANSFORM_CENTER_OFFSET) {
+			if (!ReadRawVec3(reader, state.positions[entity_id].center_offset)) {
+				return false;
+			}
+		}
+		if (flags & TRANSFORM_ROTATION_OFFSET) {
+			if (!ReadRawVec3(reader, state.orientations[entity_id].rotation_offset)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void WriteStateDelta(const GameState& baseline, const GameState& state, proto::GameStateUpdate& gsu) {
+		gsu.set_state_id(state.state_id);
+		gsu.set_command_id(state.command_id);
+		for (const auto& base : baseline.positions) {
+			if (state.positions.find(base.first) == state.positions.end()) {
+				gsu.add_removed_entity(base.first);
+			}
+		}
+		std::string* transforms = gsu.mutable_transforms();
+		for (const auto& pos : state.positions) {
+			WriteTransformDelta(pos.first, baseline, state, *transforms);
+		}
+	}
+
+	bool ApplyStateDelta(const GameState& baseline, const proto::GameStateUpdate& gsu, GameState& state) {
+		state = baseline;
+		for (int i = 0; i < gsu.removed_entity_size(); ++i) {
+			RemoveEntity(gsu.removed_entity(i), state);
+		}
+		const std::string& transforms = gsu.transforms();
+		std::size_t pos = 0;
+		while (pos < transforms.size()) {
+			if (!ReadTransformFragment(transforms.data(), transforms.size(), pos, state)) {
+				return false;
+			}
+		}
+		// Full precision entities, as GameState::Out writes them, still apply on top.
+		for (int e = 0; e < gsu.entity_size(); ++e) {
+			ApplyEntity(gsu.entity(e), state);
+		}
+		state.state_id = gsu.state_id();
+		state.command_id = gsu.command_id();
+		return true;
+	}
+
+	bool ReadStateUpdateHeader(const char* data, std::size_t size, StateUpdateHeader& header) {
+		header = StateUpdateHeader();
+		bool has_state_id = false, has_command_id = false;
+		std::size_t pos = 0;
+		WireField field;
+		while (pos < size) {
+			if (!ReadWireField(data, size, pos, field)) {
+				return false;
+			}
+			const bool varint = field.wire_type == WIRE_VARINT;
+			switch (field.number) {
+				case GSU_STATE_ID:
+				if (!varint) {
+					return false;
+				}
+				header.state_id = static_cast<state_id_t>(field.value);
+				has_state_id = true;
+				break;
+				case GSU_COMMAND_ID:
+				if (!varint) {
+					return false;
+				}
+				header.command_id = static_cast<state_id_t>(field.value);
+				has_command_id = true;
+				break;
+				case GSU_BASELINE_STATE_ID:
+				if (!varint) {
+					return false;
+				}
+				header.baseline_state_id = static_cast<state_id_t>(field.value);
+				break;
+				case GSU_REMOVED_ENTITY:
+				if (!varint && field.wire_type != WIRE_LENGTH_DELIMITED) { // Packed or not.
+					return false;
+				}
+				break;
+				case GSU_ENTITY:
+				case GSU_TRANSFORMS:
+				if (field.wire_type != WIRE_LENGTH_DELIMITED) {
+					return false;
+				}
+				break;
+				default:
+				break; // Added after this was written, skipped as protobuf would.
+			}
+		}
+		return has_state_id && has_command_id;
+	}
+
+	bool ApplyStateDelta(const GameState& baseline, const char* data, std::size_t size, GameState& state) {
+		StateUpdateHeader header;
+		if (!ReadStateUpdateHeader(data, size, header)) {
+			return false;
+		}
+		// Same order as the message version: removals, then fragments, then full precision entities.
+		// A singular field repeated on the wire means its last value, as protobuf merges it.
+		state = baseline;
+		const char* transforms = nullptr;
+		std::size_t transforms_size = 0;
+		bool has_entities = false;
+		std::size_t pos = 0;
+		WireField field;
+		while (pos < size) {
+			ReadWireField(data, size, pos, field); // Already checked by ReadStateUpdateHeader.
+			if (field.number == GSU_REMOVED_ENTITY) {
+				if (field.wire_type == WIRE_VARINT) {
+					RemoveEntity(static_cast<eid>(field.value), state);
+					continue;
+				}
+				std::size_t packed_pos = 0;
+				std::uint64_t entity_id;
+				while (packed_pos < field.length) {
+					if (!ReadVarint(field.data, field.length, packed_pos, entity_id)) {
+						return false;
+					}
+					RemoveEntity(static_cast<eid>(entity_id), state);
+				}
+			}
+			else if (field.number == GSU_TRANSFORMS) {
+				transforms = field.data;
+				transforms_size = field.length;
+			}
+			else if (field.number == GSU_ENTITY) {
+				has_entities = true;
+			}
+		}
+		pos = 0;
+		while (pos < transforms_size) {
+			if (!ReadTransformFragment(transforms, transforms_size, pos, state)) {
+				return false;
+			}
+		}
+		// Rarely sent, so these are still parsed as messages.
+		pos = 0;
+		while (has_entities && pos < size) {
+			ReadWireField(data, size, pos, field);
+			if (field.number == GSU_ENTITY) {
+				proto::Entity entity;
+				if (!entity.ParseFromArray(field.data, static_cast<int>(field.length))) {
+					return false;
+				}
+				ApplyEntity(entity, state);
+			}
+		}
+		state.state_id = header.state_id;
+		state.command_id = header.command_id;
+		return true;
+	}
+}
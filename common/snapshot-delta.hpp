@@ -0,0 +1,99 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include <game_state.pb.h>
+
+#include "types.hpp"
+#include "game-state.hpp"
+#include "quantization.hpp"
+
+namespace tec {
+	// Entities are replicated as transform fragments, quantized as set by QuantizationSettings,
+	// concatenated into GameStateUpdate::transforms. A fragment is:
+	//   varint entity id, u8 flags
+	// followed, for each flag that is set and in this order, by a block padded to a whole byte:
+	//   position: 3 x position_bits
+	//   orientation: 2 bit index of the dropped component, 3 x orientation_bits
+	//   linear velocity, angular velocity: 3 x velocity_bits each
+	//   center offset, rotation offset: 3 x 32 bit float each (rarely set, so not quantized)
+	// Values are packed least significant bit first.
+	enum TransformFlags : std::uint8_t {
+		TRANSFORM_POSITION = 1 << 0,
+		TRANSFORM_ORIENTATION = 1 << 1,
+		TRANSFORM_LINEAR_VELOCITY = 1 << 2,
+		TRANSFORM_ANGULAR_VELOCITY = 1 << 3,
+		TRANSFORM_CENTER_OFFSET = 1 << 4,
+		TRANSFORM_ROTATION_OFFSET = 1 << 5,
+	};
+
+	// One entity's transform with each block already quantized and packed, so it only has to be
+	// encoded once per tick however many clients it is sent to.
+	struct EncodedTransform {
+		enum { block_count = 6 };
+		enum { max_block_size = 13 }; // 2 + 3 x 32 bits.
+
+		std::uint8_t present{ 0 }; // TransformFlags of the blocks that are set.
+		std::uint8_t sizes[block_count]{ };
+		char blocks[block_count][max_block_size];
+
+		bool SameBlock(int block, const EncodedTransform& other) const {
+			return this->sizes[block] == other.sizes[block] &&
+				std::memcmp(this->blocks[block], other.blocks[block], this->sizes[block]) == 0;
+		}
+	};
+
+	typedef std::unordered_map<eid, EncodedTransform> EncodedState;
+
+	// Quantizes and packs entity_id's transform out of state. Offset blocks are set whenever
+	// their component is.
+	void EncodeTransform(eid entity_id, const GameState& state, EncodedTransform& transform,
+		const QuantizationSettings& settings = REPLICATION_QUANTIZATION);
+
+	// Encodes every positioned entity in state, reusing out's storage.
+	void EncodeState(const GameState& state, EncodedState& out,
+		const QuantizationSettings& settings = REPLICATION_QUANTIZATION);
+
+	// Appends a fragment made of the blocks of transform that differ from baseline, or that the
+	// baseline lacks (offsets only if they're nonzero, as that's what the client defaults to).
+	// baseline may be null. Returns false, appending nothing, if no block differs.
+	bool WriteTransformDelta(eid entity_id, const EncodedTransform& transform, const EncodedTransform* baseline,
+		std::string& out);
+
+	// As above, encoding entity_id out of state and baseline first.
+	bool WriteTransformDelta(eid entity_id, const GameState& baseline, const GameState& state, std::string& out,
+		const QuantizationSettings& settings = REPLICATION_QUANTIZATION);
+
+	// Applies the fragment at data + pos to state and advances pos past it. Returns false if
+	// the fragment is malformed or runs past size.
+	bool ReadTransformFragment(const char* data, std::size_t size, std::size_t& pos, GameState& state,
+		const QuantizationSettings& settings = REPLICATION_QUANTIZATION);
+
+	// Writes state into gsu as a delta against baseline, including which of the baseline's
+	// entities are gone. Doesn't set baseline_state_id.
+	void WriteStateDelta(const GameState& baseline, const GameState& state, proto::GameStateUpdate& gsu);
+
+	// Rebuilds the state gsu was written from, given the baseline it was written against.
+	// Returns false if gsu is malformed.
+	bool ApplyStateDelta(const GameState& baseline, const proto::GameStateUpdate& gsu, GameState& state);
+
+	// The fields of a serialized GameStateUpdate needed before it can be applied.
+	struct StateUpdateHeader {
+		state_id_t state_id{ 0 };
+		state_id_t command_id{ 0 };
+		state_id_t baseline_state_id{ 0 };
+	};
+
+	// Reads header out of the serialized GameStateUpdate in data without parsing it into a message.
+	// Returns false if data isn't a well formed GameStateUpdate.
+	bool ReadStateUpdateHeader(const char* data, std::size_t size, StateUpdateHeader& header);
+
+	// As above, but decodes the serialized GameStateUpdate in data straight into state. Removed
+	// entities and fragments are read in place, so no protobuf objects are built on the way.
+	bool ApplyStateDelta(const GameState& baseline, const char* data, std::size_t size, GameState& state);
+}
@@ -3,15 +3,20 @@
 
 #include "client-connection.hpp"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
-#include <thread>
+#include <limits>
 
 #include <game_state.pb.h>
 #include <commands.pb.h>
 
 #include "event-system.hpp"
 #include "events.hpp"
+#include "snapshot-delta.hpp"
+#include "command-history.hpp"
 #include "server.hpp"
+#include "tick-profiler.hpp"
 #include "entity.hpp"
 #include "components/transforms.hpp"
 #include "controllers/fps-controller.hpp"
@@ -20,7 +25,12 @@
 
 namespace tec {
 	namespace networking {
-		std::mutex ClientConnection::write_msg_mutex;
+		std::size_t MAX_WRITE_BATCH = 64;
+		bool FLUSH_ON_TICK = true;
+		std::size_t SNAPSHOT_BUDGET_BYTES = 400;
+		std::size_t MAX_REMOVED_ENTITIES_PER_UPDATE = 32;
+		std::size_t SNAPSHOT_HISTORY_SIZE = 32;
+		std::size_t ENTITY_STREAM_BUDGET_BYTES = 8192;
 		ClientConnection::~ClientConnection() {
 			std::shared_ptr<ControllerRemovedEvent> data = std::make_shared<ControllerRemovedEvent>();
 			data->controller = this->controller;
@@ -31,26 +41,37 @@ namespace tec {
 			}
 		}
 		void ClientConnection::StartRead() {
-			read_header();
+			auto self(shared_from_this());
+			asio::post(this->strand, [this, self] () {
+				read();
+			});
 		}
 
 		void ClientConnection::QueueWrite(const ServerMessage& msg) {
-			bool write_in_progress;
-			{
-				std::lock_guard<std::mutex> lock(write_msg_mutex);
-				write_in_progress = !write_msgs_.empty();
-				write_msgs_.push_back(msg);
-			}
-			if (!write_in_progress) {
-				do_write();
+			QueueWrite(std::make_shared<const ServerMessage>(msg));
+		}
+
+		void ClientConnection::QueueWrite(std::shared_ptr<const ServerMessage> msg, std::shared_ptr<const ServerMessage> compressed) {
+			this->queued_writes.Push(QueuedMessage{ std::move(msg), std::move(compressed) });
+			if (!FLUSH_ON_TICK) {
+				Flush();
 			}
 		}
 
+		void ClientConnection::Flush() {
+			auto self(shared_from_this());
+			asio::post(this->strand, [this, self] () {
+				if (!this->write_in_progress) {
+					do_write();
+				}
+			});
+		}
+
 		void ClientConnection::SetID(eid _id) {
 			this->id = _id;
 			this->entity.set_id(this->id);
 			std::string message(std::to_string(this->id));
-			static ServerMessage id_message;
+			ServerMessage id_message;
 			id_message.SetMessageType(MessageType::CLIENT_ID);
 			id_message.SetBodyLength(message.size());
 			memcpy(id_message.GetBodyPTR(), message.c_str(), id_message.GetBodyLength());
@@ -58,6 +79,40 @@ namespace tec {
 			QueueWrite(id_message);
 		}
 
+		void ClientConnection::SetUDPConnectionID(std::uint32_t connection_id) {
+			this->udp_connection_id = connection_id;
+			this->udp_channel.SetConnectionID(connection_id);
+			std::string message(std::to_string(connection_id));
+			ServerMessage handshake_message;
+			handshake_message.SetMessageType(MessageType::UDP_HANDSHAKE);
+			handshake_message.SetBodyLength(message.size());
+			memcpy(handshake_message.GetBodyPTR(), message.c_str(), handshake_message.GetBodyLength());
+			handshake_message.encode_header();
+			QueueWrite(handshake_message);
+		}
+
+		void ClientConnection::ReceiveDatagram(const char* data, std::size_t length, const udp::endpoint& from) {
+			auto self(shared_from_this());
+			std::vector<char> datagram(data, data + length);
+			asio::post(this->strand, [this, self, datagram = std::move(datagram), from] () {
+				bool valid = this->udp_channel.ReadPacket(datagram.data(), datagram.size(), [this] (ServerMessage& msg) {
+					handle_message(msg);
+				});
+				if (!valid) {
+					return;
+				}
+				// Follow the client if its address changes, e.g. a NAT rebinding.
+				this->udp_endpoint = from;
+				if (!this->udp_active) {
+					this->udp_active = true;
+					// Answer straight away so the client knows the channel works.
+					if (!this->write_in_progress) {
+						do_write();
+					}
+				}
+			});
+		}
+
 		void ClientConnection::DoJoin() {
 			// Build an entity
 			Entity self(this->id);
@@ -82,6 +137,7 @@ namespace tec {
 			entity_create_msg.SetMessageType(MessageType::ENTITY_CREATE);
 			entity_create_msg.encode_header();
 			QueueWrite(entity_create_msg);
+			this->known_entities.insert(this->id);
 			std::shared_ptr<EntityCreated> data = std::make_shared<EntityCreated>();
 			data->entity = this->entity;
 			data->entity_id = this->entity.id();
@@ -94,151 +150,402 @@ namespace tec {
 		}
 
 		void ClientConnection::DoLeave() {
-			static ServerMessage leave_msg;
+			ServerMessage leave_msg;
 			leave_msg.SetMessageType(MessageType::CLIENT_LEAVE);
 			std::string message(std::to_string(this->id));
 			leave_msg.SetBodyLength(message.size());
 			memcpy(leave_msg.GetBodyPTR(), message.c_str(), leave_msg.GetBodyLength());
 			leave_msg.encode_header();
 			this->server->Deliver(leave_msg, false);
+			InputBufferStats input_stats = GetInputBufferStats();
+			std::cout << "Client " << this->id << " input buffer: " << input_stats.underruns << " underruns, "
+				<< input_stats.overruns << " overruns, " << input_stats.late << " late, "
+				<< input_stats.recovered << " recovered from resends" << std::endl;
 			std::shared_ptr<EntityDestroyed> data = std::make_shared<EntityDestroyed>();
 			data->entity_id = this->id;
 			EventSystem<EntityDestroyed>::Get()->Emit(data);
 		}
 
-		void ClientConnection::OnClientLeave(eid entity_id) {
-			if (this->state_changes_since_confirmed.positions.find(entity_id) != this->state_changes_since_confirmed.positions.end()) {
-				this->state_changes_since_confirmed.positions.erase(entity_id);
-			}
-			if (this->state_changes_since_confirmed.orientations.find(entity_id) != this->state_changes_since_confirmed.orientations.end()) {
-				this->state_changes_since_confirmed.orientations.erase(entity_id);
-			}
-			if (this->state_changes_since_confirmed.velocities.find(entity_id) != this->state_changes_since_confirmed.velocities.end()) {
-				this->state_changes_since_confirmed.velocities.erase(entity_id);
+		void ClientConnection::ConsumeCommand() {
+			std::shared_ptr<ClientCommandsEvent> data = std::make_shared<ClientCommandsEvent>();
+			{
+				std::lock_guard<std::mutex> lock(this->input_mutex);
+				if (!this->input_buffer.Pop(*data)) {
+					return;
+				}
 			}
+			this->last_recv_command_id = data->client_commands.commandid();
+			EventSystem<ClientCommandsEvent>::Get()->Emit(data);
 		}
 
-		void ClientConnection::read_header() {
-			auto self(shared_from_this());
-			asio::async_read(
-				socket,
-				asio::buffer(current_read_msg.GetDataPTR(), ServerMessage::header_length),
-				[this, self] (std::error_code error, std::size_t /*length*/) {
-					if (!error && current_read_msg.decode_header()) {
-						read_body();
-					}
-					else {
-						server->Leave(shared_from_this());
-					}
-				});
+		void ClientConnection::OnClientLeave(eid entity_id) {
+			this->known_entities.erase(entity_id);
+			this->priority_accumulators.erase(entity_id);
+			this->relevant_state.positions.erase(entity_id);
+			this->relevant_state.orientations.erase(entity_id);
+			this->relevant_state.velocities.erase(entity_id);
 		}
 
-		void ClientConnection::read_body() {
+		void ClientConnection::read() {
 			auto self(shared_from_this());
-			asio::async_read(
-				socket,
-				asio::buffer(this->current_read_msg.GetBodyPTR(), this->current_read_msg.GetBodyLength()),
-				[this, self] (std::error_code error, std::size_t /*length*/) {
-					if (!error) {
-						switch (this->current_read_msg.GetMessageType()) {
-							case MessageType::CHAT_MESSAGE:
-							server->Deliver(this->current_read_msg);
-							std::cout.write(this->current_read_msg.GetBodyPTR(),
-											this->current_read_msg.GetBodyLength()) << std::endl;
-							break;
-							case MessageType::SYNC:
-							QueueWrite(this->current_read_msg);
-							break;
-							case MessageType::CLIENT_COMMAND:
-							{
-								// Pass this along to be handled in simulation to allow for
-								// processing of string commands as well as movement.
-
-								// TODO: just apply movement commands here and split string commands
-								// to a different message.
-								proto::ClientCommands proto_client_commands;
-								proto_client_commands.ParseFromArray(
-									current_read_msg.GetBodyPTR(),
-									static_cast<int>(current_read_msg.GetBodyLength()));
-								this->last_confirmed_state_id = current_read_msg.GetStateID();
-								std::shared_ptr<ClientCommandsEvent> data = std::make_shared<ClientCommandsEvent>();
-								data->client_commands = std::move(proto_client_commands);
-								this->last_recv_command_id = proto_client_commands.commandid();
-								EventSystem<ClientCommandsEvent>::Get()->Emit(data);
-							}
-							break;
+			this->socket.async_read_some(
+				asio::buffer(this->receive_buffer.GetWritePTR(), this->receive_buffer.GetWriteSpace()),
+				asio::bind_executor(this->strand,
+					[this, self] (std::error_code error, std::size_t length) {
+						if (error) {
+							server->Leave(shared_from_this());
+							return;
+						}
+						this->receive_buffer.Commit(length);
+						ReceiveBuffer::Result result;
+						while ((result = this->receive_buffer.Next(this->current_read_msg)) == ReceiveBuffer::Result::MESSAGE) {
+							handle_message(this->current_read_msg);
+						}
+						if (result == ReceiveBuffer::Result::INVALID) {
+							server->Leave(shared_from_this());
+							return;
 						}
-						std::this_thread::sleep_for(std::chrono::milliseconds(1));
-						read_header();
+						read();
+					}));
+		}
+
+		void ClientConnection::handle_message(ServerMessage& msg) {
+			switch (msg.GetMessageType()) {
+				case MessageType::CHAT_MESSAGE:
+				server->Deliver(msg);
+				std::cout.write(msg.GetBodyPTR(), msg.GetBodyLength()) << std::endl;
+				break;
+				case MessageType::SYNC:
+				QueueWrite(msg);
+				Flush(); // Pings are timed so don't wait for the end of the tick.
+				break;
+				case MessageType::COMPRESSION:
+				{
+					std::string offer(msg.GetBodyPTR(), msg.GetBodyLength());
+					this->compression_codec = MESSAGE_COMPRESSION ? PickCodec(offer) : CompressionCodec::NONE;
+					this->zlib_picked = this->compression_codec == CompressionCodec::ZLIB;
+					std::string codec(GetCodecName(this->compression_codec));
+					ServerMessage codec_msg;
+					codec_msg.SetMessageType(MessageType::COMPRESSION);
+					codec_msg.SetBodyLength(codec.size());
+					memcpy(codec_msg.GetBodyPTR(), codec.c_str(), codec_msg.GetBodyLength());
+					codec_msg.encode_header();
+					QueueWrite(codec_msg);
+				}
+				break;
+				case MessageType::SERVER_STATS:
+				{
+					const TickProfiler* profiler = server->GetTickProfiler();
+					std::string stats = profiler ? profiler->GetProfile().ToString() : std::string("No tick profile");
+					ServerMessage stats_msg;
+					stats_msg.SetMessageType(MessageType::SERVER_STATS);
+					stats_msg.SetBodyLength(std::min(stats.size(), static_cast<std::size_t>(ServerMessage::max_body_length)));
+					memcpy(stats_msg.GetBodyPTR(), stats.c_str(), stats_msg.GetBodyLength());
+					stats_msg.encode_header();
+					QueueWrite(stats_msg);
+				}
+				break;
+				case MessageType::CLIENT_COMMAND:
+				{
+					// Pass this along to be handled in simulation to allow for
+					// processing of string commands as well as movement.
+
+					// TODO: just apply movement commands here and split string commands
+					// to a different message.
+					proto::ClientCommands proto_client_commands;
+					if (!proto_client_commands.ParseFromArray(msg.GetBodyPTR(), static_cast<int>(msg.GetBodyLength()))) {
+						break;
 					}
-					else {
-						server->Leave(shared_from_this());
+					this->last_confirmed_state_id = msg.GetStateID();
+					// Each message also carries the commands before it that we hadn't acked. Held
+					// until the simulation consumes them, one per tick, and deduped by command id.
+					this->received_commands.clear();
+					ExpandClientCommands(proto_client_commands, this->received_commands);
+					std::lock_guard<std::mutex> lock(this->input_mutex);
+					for (proto::ClientCommands& client_commands : this->received_commands) {
+						ClientCommandsEvent command;
+						command.client_commands = std::move(client_commands);
+						command.state_id = msg.GetStateID();
+						const bool redundant = command.client_commands.commandid() != proto_client_commands.commandid();
+						this->input_buffer.Push(std::move(command), redundant);
 					}
-				});
+				}
+				break;
+				default:
+				break;
+			}
 		}
 
+		// Must run on the strand. Gathers up to MAX_WRITE_BATCH queued messages into one
+		// vectored write. The buffers point into the messages themselves, which the shared
+		// pointers in write_msgs_ keep alive until the write completes.
 		void ClientConnection::do_write() {
+			this->queued_writes.ConsumeAll([this] (QueuedMessage&& queued) {
+				std::shared_ptr<const ServerMessage> msg = std::move(queued.msg);
+				if (this->compression_codec == CompressionCodec::ZLIB && MESSAGE_COMPRESSION) {
+					if (queued.compressed) {
+						msg = std::move(queued.compressed);
+					}
+					else if (!msg->IsCompressed() && msg->GetBodyLength() >= COMPRESSION_THRESHOLD) {
+						// Shared messages can't be changed in place.
+						std::shared_ptr<ServerMessage> compressed = std::make_shared<ServerMessage>(*msg);
+						if (this->compressor.Compress(*compressed)) {
+							msg = std::move(compressed);
+						}
+					}
+				}
+				if (this->udp_active) {
+					this->udp_channel.Queue(*msg);
+				}
+				else {
+					write_msgs_.push_back(std::move(msg));
+				}
+			});
+			if (this->udp_active) {
+				if (this->udp_channel.IsStalled()) {
+					// The client has stopped acking, so its UDP path is gone. Reliable messages
+					// can't be moved back to TCP without losing or repeating some, so drop it.
+					std::cout << "Client " << this->id << " stopped acking datagrams" << std::endl;
+					asio::error_code ignored;
+					this->socket.close(ignored);
+					server->Leave(shared_from_this());
+					return;
+				}
+				write_datagrams();
+			}
+			if (write_msgs_.empty()) {
+				return;
+			}
 			auto self(shared_from_this());
-			std::lock_guard<std::mutex> lock(write_msg_mutex);
+			const std::size_t batch_size = std::min(write_msgs_.size(), MAX_WRITE_BATCH);
+			this->write_in_progress = true;
+			this->write_buffers.clear();
+			for (std::size_t i = 0; i < batch_size; ++i) {
+				this->write_buffers.push_back(asio::buffer(write_msgs_[i]->GetDataPTR(), write_msgs_[i]->length()));
+			}
 			asio::async_write(
 				socket,
-				asio::buffer(write_msgs_.front().GetDataPTR(),
-							 write_msgs_.front().length()),
-				[this, self] (std::error_code error, std::size_t /*length*/) {
-					if (!error) {
-						bool more_to_write = false;
-						{
-							std::lock_guard<std::mutex> lock(write_msg_mutex);
-							write_msgs_.pop_front();
-							more_to_write = !write_msgs_.empty();
+				this->write_buffers,
+				asio::bind_executor(this->strand,
+					[this, self, batch_size] (std::error_code error, std::size_t /*length*/) {
+						if (!error) {
+							write_msgs_.erase(write_msgs_.begin(), write_msgs_.begin() + batch_size);
+							this->write_in_progress = false;
+							// Messages queued while this write was in flight would only be
+							// waiting behind it, so send them now as the next batch.
+							if (!write_msgs_.empty() || !this->queued_writes.empty()) {
+								do_write();
+							}
 						}
-						if (more_to_write) {
-							do_write();
+						else {
+							server->Leave(shared_from_this());
 						}
-					}
-					else {
-						server->Leave(shared_from_this());
-					}
-				});
+					}));
+		}
+
+		void ClientConnection::write_datagrams() {
+			// Bounded so a backlog of reliable messages can't hog the io thread.
+			const int max_datagrams_per_flush = 16;
+			char datagram[ReliableChannel::max_packet_size];
+			int datagrams = 0;
+			do {
+				std::size_t length = this->udp_channel.WritePacket(datagram, sizeof(datagram));
+				server->SendDatagram(this->udp_endpoint, datagram, length);
+			} while (++datagrams < max_datagrams_per_flush && this->udp_channel.HasPending());
 		}
 
-		void ClientConnection::UpdateGameState(const GameState& full_state) {
-			for (auto pair : full_state.positions) {
-				if (full_state.positions.find(pair.first) != full_state.positions.end()) {
-					this->state_changes_since_confirmed.positions[pair.first] = full_state.positions.at(pair.first);
+		void ClientConnection::UpdateGameState(const GameState& full_state, const InterestManager& interest) {
+			auto own_position = full_state.positions.find(this->id);
+			if (own_position == full_state.positions.end()) {
+				return; // Not in the simulation yet.
+			}
+			this->relevant_entities.clear();
+			interest.Query(own_position->second.value, InterestManager::GetMaxRadius(this->interest_rules), this->relevant_entities);
+			this->relevant_set.clear();
+			this->relevant_set.insert(this->relevant_entities.begin(), this->relevant_entities.end());
+			this->relevant_set.insert(this->id);
+			this->relevant_set.insert(this->static_entities.begin(), this->static_entities.end());
+
+			// Entities that left the area of interest.
+			for (auto itr = this->known_entities.begin(); itr != this->known_entities.end(); ) {
+				if (this->relevant_set.count(*itr)) {
+					++itr;
+					continue;
 				}
-				if (full_state.orientations.find(pair.first) != full_state.orientations.end()) {
-					this->state_changes_since_confirmed.orientations[pair.first] = full_state.orientations.at(pair.first);
+				ServerMessage destroy_msg;
+				destroy_msg.SetMessageType(MessageType::ENTITY_DESTROY);
+				std::string message(std::to_string(*itr));
+				destroy_msg.SetBodyLength(message.size());
+				memcpy(destroy_msg.GetBodyPTR(), message.c_str(), destroy_msg.GetBodyLength());
+				destroy_msg.encode_header();
+				QueueWrite(destroy_msg);
+				const eid entity_id = *itr;
+				itr = this->known_entities.erase(itr);
+				OnClientLeave(entity_id); // Its state no longer needs to be sent.
+			}
+
+			// Entities that entered the area of interest are streamed in nearest first, as many
+			// per tick as the stream budget allows, so a client joining a crowded area (or
+			// arriving in one) keeps getting its updates between them. Entities without a
+			// position count as nearest.
+			this->entering.clear();
+			for (eid entity_id : this->relevant_set) {
+				if (this->known_entities.count(entity_id)) {
+					continue;
 				}
-				if (full_state.velocities.find(pair.first) != full_state.velocities.end()) {
-					this->state_changes_since_confirmed.velocities[pair.first] = full_state.velocities.at(pair.first);
+				float distance_squared = 0.0f;
+				auto position = full_state.positions.find(entity_id);
+				if (position != full_state.positions.end()) {
+					const glm::vec3 offset = position->second.value - own_position->second.value;
+					distance_squared = glm::dot(offset, offset);
+				}
+				this->entering.emplace_back(distance_squared, entity_id);
+			}
+			std::sort(this->entering.begin(), this->entering.end());
+			std::size_t streamed_bytes = 0;
+			const bool compressed = this->zlib_picked && MESSAGE_COMPRESSION; // As do_write() decides.
+			for (const auto& entry : this->entering) {
+				QueuedMessage create_msg;
+				if (!this->server->GetEntityCreateMessage(entry.second, create_msg)) {
+					continue; // Not replicated, e.g. a client that is still joining.
+				}
+				// Charged for what is sent, which is the cached compressed copy if the client has one.
+				const std::size_t length = compressed && create_msg.compressed ?
+					create_msg.compressed->length() : create_msg.msg->length();
+				// At least one per tick however big, so the stream always moves.
+				if (streamed_bytes > 0 && streamed_bytes + length > this->stream_budget) {
+					break;
+				}
+				streamed_bytes += length;
+				QueueWrite(std::move(create_msg.msg), std::move(create_msg.compressed));
+				this->known_entities.insert(entry.second);
+			}
+
+			for (eid entity_id : this->relevant_set) {
+				if (!this->known_entities.count(entity_id)) {
+					continue; // Still waiting to be streamed.
+				}
+				auto position = full_state.positions.find(entity_id);
+				if (position != full_state.positions.end()) {
+					this->relevant_state.positions[entity_id] = position->second;
+				}
+				auto orientation = full_state.orientations.find(entity_id);
+				if (orientation != full_state.orientations.end()) {
+					this->relevant_state.orientations[entity_id] = orientation->second;
+				}
+				auto velocity = full_state.velocities.find(entity_id);
+				if (velocity != full_state.velocities.end()) {
+					this->relevant_state.velocities[entity_id] = velocity->second;
 				}
 			}
 		}
 
-		tec::networking::ServerMessage ClientConnection::PrepareGameStateUpdateMessage(state_id_t current_state_id) {
-			tec::proto::GameStateUpdate gsu_msg;
+		bool ClientConnection::PrepareGameStateUpdateMessage(state_id_t current_state_id, const EncodedState& encoded,
+			ScratchArena& arena, ServerMessage& update_message) {
+			// Floor so entities past the outermost band still get sent eventually.
+			const float min_priority = 0.01f;
+			// Speed at which an entity's priority is doubled.
+			const float speed_priority_scale = 10.0f;
+
+			tec::proto::GameStateUpdate& gsu_msg = *arena.Create<tec::proto::GameStateUpdate>();
 			gsu_msg.set_state_id(current_state_id);
 			gsu_msg.set_command_id(this->last_recv_command_id);
-			for (auto pos : this->state_changes_since_confirmed.positions) {
-				tec::proto::Entity* _entity = gsu_msg.add_entity();
-				_entity->set_id(pos.first);
-				pos.second.Out(_entity->add_components());
-				if (this->state_changes_since_confirmed.orientations.find(pos.first) != this->state_changes_since_confirmed.orientations.end()) {
-					tec::Orientation ori = this->state_changes_since_confirmed.orientations.at(pos.first);
-					ori.Out(_entity->add_components());
+
+			// Snapshots older than the acked one can never be a baseline again. If the acked one
+			// has already dropped out of the history the client is sent everything.
+			const state_id_t acked_state_id = this->last_confirmed_state_id;
+			while (!this->sent_snapshots.empty() && this->sent_snapshots.front().state_id < acked_state_id) {
+				this->sent_snapshots.pop_front();
+			}
+			static const EncodedState empty_state;
+			const EncodedState* baseline = &empty_state;
+			if (!this->sent_snapshots.empty() && this->sent_snapshots.front().state_id == acked_state_id) {
+				baseline = &this->sent_snapshots.front().transforms;
+				gsu_msg.set_baseline_state_id(acked_state_id);
+			}
+			// What the client will have once it applies this update.
+			SentSnapshot snapshot{ current_state_id, *baseline };
+			for (const auto& base : *baseline) {
+				if (static_cast<std::size_t>(gsu_msg.removed_entity_size()) >= MAX_REMOVED_ENTITIES_PER_UPDATE) {
+					break; // The rest are still in snapshot, so a later update removes them.
 				}
-				if (this->state_changes_since_confirmed.velocities.find(pos.first) != this->state_changes_since_confirmed.velocities.end()) {
-					tec::Velocity vel = this->state_changes_since_confirmed.velocities.at(pos.first);
-					vel.Out(_entity->add_components());
+				if (this->relevant_state.positions.find(base.first) == this->relevant_state.positions.end()) {
+					gsu_msg.add_removed_entity(base.first);
+					snapshot.transforms.erase(base.first);
 				}
 			}
-			tec::networking::ServerMessage update_message;
+
+			// Each tick an entity waits its priority grows by an amount set by its distance
+			// band and speed, so stale entities eventually win out over nearby ones.
+			const GameState& changes = this->relevant_state;
+			glm::vec3 own_position(0.0f);
+			auto own = changes.positions.find(this->id);
+			if (own != changes.positions.end()) {
+				own_position = own->second.value;
+			}
+			this->send_order.clear();
+			for (const auto& pos : changes.positions) {
+				if (pos.first == this->id) {
+					this->send_order.emplace_back(std::numeric_limits<float>::max(), pos.first); // Always first.
+					continue;
+				}
+				const float distance = glm::distance(pos.second.value, own_position);
+				float priority = std::max(InterestManager::GetPriority(this->interest_rules, distance), min_priority);
+				auto vel = changes.velocities.find(pos.first);
+				if (vel != changes.velocities.end()) {
+					priority *= 1.0f + glm::length(glm::vec3(vel->second.linear)) / speed_priority_scale;
+				}
+				this->send_order.emplace_back(this->priority_accumulators[pos.first] += priority, pos.first);
+			}
+			std::sort(this->send_order.begin(), this->send_order.end(), std::greater<std::pair<float, eid>>());
+
+			// Fragments are assembled from blocks encoded once this tick, only which blocks go
+			// to this client is worked out here. The budget covers the whole update, so leave room
+			// for what is already in it and the transforms field's own tag and length.
+			const std::size_t max_size = std::min<std::size_t>(this->snapshot_budget, ServerMessage::max_body_length);
+			const std::size_t used_size = static_cast<std::size_t>(gsu_msg.ByteSize()) + 3;
+			const std::size_t budget = max_size > used_size ? max_size - used_size : 0;
+			std::string* transforms = &this->transforms_scratch;
+			transforms->clear();
+			for (const auto& entry : this->send_order) {
+				const eid entity_id = entry.second;
+				auto transform = encoded.find(entity_id);
+				if (transform == encoded.end()) {
+					continue;
+				}
+				auto base = baseline->find(entity_id);
+				const std::size_t size_before = transforms->size();
+				if (!WriteTransformDelta(entity_id, transform->second,
+					base == baseline->end() ? nullptr : &base->second, *transforms)) {
+					this->priority_accumulators[entity_id] = 0.0f; // The client is already up to date.
+					continue;
+				}
+				if (transforms->size() > budget) {
+					transforms->resize(size_before); // A smaller entity further down may still fit.
+					continue;
+				}
+				this->priority_accumulators[entity_id] = 0.0f;
+				snapshot.transforms[entity_id] = transform->second;
+			}
+			// Swapped back before the arena can destroy it, so no copy is made and the buffer is kept.
+			gsu_msg.mutable_transforms()->swap(this->transforms_scratch);
+			const std::size_t body_length = static_cast<std::size_t>(gsu_msg.ByteSize());
+			const bool serialized = body_length <= ServerMessage::max_body_length &&
+				gsu_msg.SerializeToArray(update_message.GetBodyPTR(), static_cast<int>(body_length));
+			gsu_msg.mutable_transforms()->swap(this->transforms_scratch);
+			if (!serialized) {
+				// Never sent, so it mustn't become a baseline.
+				std::cout << "Client " << this->id << " update of " << body_length << " bytes didn't fit in a message" << std::endl;
+				return false;
+			}
 			update_message.SetMessageType(tec::networking::MessageType::GAME_STATE_UPDATE);
-			update_message.SetBodyLength(gsu_msg.ByteSize());
-			gsu_msg.SerializeToArray(update_message.GetBodyPTR(), static_cast<int>(update_message.GetBodyLength()));
+			update_message.SetBodyLength(body_length);
 			update_message.encode_header();
-			return std::move(update_message);
+			this->sent_snapshots.push_back(std::move(snapshot));
+			while (this->sent_snapshots.size() > SNAPSHOT_HISTORY_SIZE) {
+				this->sent_snapshots.pop_front();
+			}
+			return true;
 		}
 	}
 }
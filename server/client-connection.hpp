@@ -3,16 +3,30 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <asio.hpp>
-#include <mutex>
 #include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "types.hpp"
+#include "mpsc-queue.hpp"
 #include "server-message.hpp"
+#include "receive-buffer.hpp"
+#include "reliable-channel.hpp"
+#include "message-compression.hpp"
 #include "game-state.hpp"
+#include "interest-manager.hpp"
+#include "input-buffer.hpp"
+#include "snapshot-delta.hpp"
+#include "scratch-arena.hpp"
 
 using asio::ip::tcp;
+using asio::ip::udp;
 
 namespace tec {
 	struct FPSController;
@@ -20,19 +34,64 @@ namespace tec {
 	namespace networking {
 		class Server;
 
+		// Upper bound on the number of queued messages gathered into a single vectored write.
+		extern std::size_t MAX_WRITE_BATCH;
+
+		// When true, queued messages are held until Flush() is called (once per tick) so
+		// everything sent to a client during a tick goes out in one write.
+		extern bool FLUSH_ON_TICK;
+
+		// Default number of bytes each client's update may take per tick, capped by what fits in
+		// one message. Entities that don't fit wait for a later tick, their priority growing all
+		// the while.
+		extern std::size_t SNAPSHOT_BUDGET_BYTES;
+
+		// Most entities one update tells the client to remove. The rest stay in the client's
+		// snapshot and are removed by the next updates, so a crowd leaving the area of interest
+		// at once can't push an update past max_body_length.
+		extern std::size_t MAX_REMOVED_ENTITIES_PER_UPDATE;
+
+		// How many of the snapshots sent to each client are kept as possible delta baselines.
+		// Once a client's ack is older than all of them it is sent everything again.
+		extern std::size_t SNAPSHOT_HISTORY_SIZE;
+
+		// Default number of bytes of ENTITY_CREATE messages each client is sent per tick as
+		// entities come into its area of interest, most of all right after it joins.
+		extern std::size_t ENTITY_STREAM_BUDGET_BYTES;
+
+		// A message waiting to be written. Messages sent to many clients, such as cached
+		// ENTITY_CREATEs and broadcasts, are shared rather than copied for each of them.
+		struct QueuedMessage {
+			std::shared_ptr<const ServerMessage> msg;
+			// msg already compressed, for connections that negotiated compression. Cached messages
+			// carry this so they aren't compressed again for every client.
+			std::shared_ptr<const ServerMessage> compressed;
+		};
+
 		// Used to represent a client connection to the server.
 		class ClientConnection
 			: public std::enable_shared_from_this<ClientConnection> {
 		public:
 			ClientConnection(tcp::socket socket, Server* server) :
-				socket(std::move(socket)), server(server) { }
+				socket(std::move(socket)), strand(asio::make_strand(this->socket.get_executor())),
+				server(server) { }
 
 			~ClientConnection();
 
 			void StartRead();
 
+			// Queues a message for this client. Unless FLUSH_ON_TICK is off, it is only sent
+			// on the next Flush(). Lock-free, so any thread may queue without contending with
+			// the writes of other clients.
 			void QueueWrite(const ServerMessage& msg);
 
+			// Queues a shared message without copying it.
+			void QueueWrite(std::shared_ptr<const ServerMessage> msg, std::shared_ptr<const ServerMessage> compressed = nullptr);
+
+			// Starts writing everything queued so far, unless a write is already in progress
+			// in which case the queued messages go out as soon as it completes.
+			void Flush();
+
 			eid GetID() {
 				return this->id;
 			}
@@ -40,6 +99,17 @@ namespace tec {
 			// Sets the client id and sends it to this client.
 			void SetID(eid id);
 
+			// Sets the id datagrams for this client's UDP channel carry and sends it to this client.
+			void SetUDPConnectionID(std::uint32_t connection_id);
+
+			std::uint32_t GetUDPConnectionID() const {
+				return this->udp_connection_id;
+			}
+
+			// Handles a datagram received for this connection. The first valid one switches the
+			// connection's outgoing messages from TCP to the UDP channel.
+			void ReceiveDatagram(const char* data, std::size_t length, const udp::endpoint& from);
+
 			proto::Entity& GetEntity() {
 				return this->entity;
 			}
@@ -59,30 +129,135 @@ namespace tec {
 				return this->last_confirmed_state_id;
 			}
 
-			void UpdateGameState(const GameState& full_state);
+			// Replaces this client's interest rules, innermost band first.
+			void SetInterestRules(std::vector<InterestRule> rules) {
+				this->interest_rules = std::move(rules);
+			}
 
-			tec::networking::ServerMessage PrepareGameStateUpdateMessage(state_id_t current_state_id);
+			const std::vector<InterestRule>& GetInterestRules() const {
+				return this->interest_rules;
+			}
+
+			// Sets how many bytes this client's update may take per tick. Capped by what fits in
+			// one message.
+			void SetSnapshotBudget(std::size_t bytes) {
+				this->snapshot_budget = bytes;
+			}
+
+			// Sets the entities without a position, which are always in this client's area of
+			// interest. Streamed in with the rest once it joins.
+			void SetStaticEntities(std::vector<eid> entity_ids) {
+				this->static_entities = std::move(entity_ids);
+			}
+
+			// Sets how many bytes of ENTITY_CREATE messages this client is sent per tick.
+			void SetStreamBudget(std::size_t bytes) {
+				this->stream_budget = bytes;
+			}
+
+			// Emits this tick's ClientCommandsEvent from the client's input buffer, if it has sent
+			// any commands yet. Call once per tick, before simulating.
+			void ConsumeCommand();
+
+			// Sets how many commands this client's input buffer tries to keep queued.
+			void SetInputBufferDepth(std::size_t depth) {
+				std::lock_guard<std::mutex> lock(this->input_mutex);
+				this->input_buffer.SetTargetDepth(depth);
+			}
+
+			InputBufferStats GetInputBufferStats() {
+				std::lock_guard<std::mutex> lock(this->input_mutex);
+				return this->input_buffer.GetStats();
+			}
+
+			// Sends ENTITY_DESTROY for entities that left this client's area of interest, streams
+			// ENTITY_CREATE for those that entered it within the stream budget, and accumulates
+			// the state of those the client has been sent.
+			void UpdateGameState(const GameState& full_state, const InterestManager& interest);
+
+			// Builds this tick's update into update_message as a delta against the newest snapshot
+			// the client has acked, from the highest priority entities that fit in the snapshot
+			// budget. encoded is this tick's state, encoded once for all clients. The update is
+			// built on arena, which the caller resets once the tick is done. Returns false, and
+			// records nothing as sent, if the update couldn't be serialized.
+			bool PrepareGameStateUpdateMessage(state_id_t current_state_id, const EncodedState& encoded,
+				ScratchArena& arena, ServerMessage& update_message);
 
 		private:
-			void read_header();
+			// Reads whatever the client has sent and handles every complete message in it.
+			void read();
 
-			void read_body();
+			void handle_message(ServerMessage& msg);
 
 			void do_write();
 
+			// Sends everything queued on the UDP channel, plus anything due to be resent.
+			void write_datagrams();
+
 			tcp::socket socket;
+			// All of this connection's read and write handlers run on this strand, so the
+			// connection's state is never touched by two io threads at once.
+			asio::strand<tcp::socket::executor_type> strand;
+			ReceiveBuffer receive_buffer;
 			ServerMessage current_read_msg;
-			std::deque<ServerMessage> write_msgs_;
+
+			// Messages queued from any thread, picked up by do_write().
+			MPSCQueue<QueuedMessage> queued_writes;
+			// Everything below is only touched from handlers running on the strand.
+			std::deque<std::shared_ptr<const ServerMessage>> write_msgs_;
+			std::vector<asio::const_buffer> write_buffers; // Buffers of the write in progress.
+			bool write_in_progress{ false };
+			ReliableChannel udp_channel;
+			udp::endpoint udp_endpoint;
+			bool udp_active{ false };
+
+			std::uint32_t udp_connection_id{ 0 };
+			// Picked from the client's COMPRESSION offer. Outgoing messages are compressed in
+			// do_write(), so like the rest of the write state these are only touched on the strand.
+			CompressionCodec compression_codec{ CompressionCodec::NONE };
+			MessageCompressor compressor;
+			// Whether ZLIB was picked, for the simulation thread to charge the stream budget for
+			// the messages that actually go out.
+			std::atomic<bool> zlib_picked{ false };
+
 			Server* server;
 			eid id{ 0 };
 			proto::Entity entity;
-			static std::mutex write_msg_mutex;
 
 			FPSController* controller{ nullptr };
 
-			state_id_t last_confirmed_state_id{ 0 }; // That last state_id the client confirmed it received.
-			state_id_t last_recv_command_id{ 0 };
-			GameState state_changes_since_confirmed; // That state changes that happened since last_confirmed_state_id.
+			std::atomic<state_id_t> last_confirmed_state_id{ 0 }; // That last state_id the client confirmed it received.
+			state_id_t last_recv_command_id{ 0 }; // Last command applied, acked back in each update.
+			std::mutex input_mutex; // Commands are pushed from the strand and consumed by the simulation.
+			InputBuffer input_buffer;
+			std::vector<proto::ClientCommands> received_commands; // Scratch space, only touched on the strand.
+			GameState relevant_state; // Latest state of every entity in this client's area of interest.
+			// What the client's state is after each snapshot still in the history, oldest first,
+			// kept encoded so deltas are just block comparisons. Updates are deltas against the
+			// one the client last acked.
+			struct SentSnapshot {
+				state_id_t state_id;
+				EncodedState transforms;
+			};
+			std::deque<SentSnapshot> sent_snapshots;
+
+			// Area of interest. Only touched by the tick, on whichever thread builds this client's
+			// snapshot, or before the client is added to the client list.
+			std::vector<InterestRule> interest_rules{ DEFAULT_INTEREST_RULES };
+			std::unordered_set<eid> known_entities; // Positioned entities this client has been sent.
+			std::vector<eid> relevant_entities; // Scratch space for the interest query, reused every tick.
+			std::unordered_set<eid> relevant_set;
+			std::vector<eid> static_entities;
+			std::size_t stream_budget{ ENTITY_STREAM_BUDGET_BYTES };
+			std::vector<std::pair<float, eid>> entering; // Scratch space, nearest first.
+
+			// Snapshot budget. Also only touched by the tick.
+			std::size_t snapshot_budget{ SNAPSHOT_BUDGET_BYTES };
+			std::unordered_map<eid, float> priority_accumulators; // Grows each tick an entity isn't sent.
+			std::vector<std::pair<float, eid>> send_order; // Scratch space, reused every tick.
+			// Fragments are written here and only lent to the update while it is serialized, so
+			// the buffer outlives the arena and keeps its capacity from tick to tick.
+			std::string transforms_scratch;
 		};
 	}
 }
@@ -0,0 +1,60 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "input-buffer.hpp"
+
+#include <algorithm>
+
+namespace tec {
+	namespace networking {
+		std::size_t INPUT_BUFFER_TARGET_DEPTH = 2;
+
+		bool InputBuffer::Push(ClientCommandsEvent&& command, bool redundant) {
+			const std::uint64_t command_id = command.client_commands.commandid();
+			if ((this->has_last_command && command_id <= this->last_command.client_commands.commandid()) ||
+				this->commands.find(command_id) != this->commands.end()) {
+				if (!redundant) {
+					++this->stats.late;
+				}
+				return false;
+			}
+			if (redundant) {
+				++this->stats.recovered;
+			}
+			this->commands.emplace(command_id, std::move(command));
+			return true;
+		}
+
+		bool InputBuffer::Pop(ClientCommandsEvent& command) {
+			const std::size_t target = std::max<std::size_t>(this->target_depth, 1);
+			if (this->commands.size() > 2 * target) {
+				while (this->commands.size() > target) {
+					this->commands.erase(this->commands.begin());
+					++this->stats.overruns;
+				}
+			}
+			if (this->filling && this->commands.size() >= target) {
+				this->filling = false;
+			}
+			if (!this->filling && !this->commands.empty()) {
+				auto oldest = this->commands.begin();
+				this->last_command = std::move(oldest->second);
+				this->has_last_command = true;
+				this->commands.erase(oldest);
+				command = this->last_command;
+				return true;
+			}
+			if (!this->has_last_command) {
+				return false;
+			}
+			if (this->commands.empty()) {
+				++this->stats.underruns;
+				this->filling = true;
+			}
+			// Keep moving as the client last asked, but only run its string commands once.
+			command = this->last_command;
+			command.client_commands.clear_commandlist();
+			return true;
+		}
+	}
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+#include "events.hpp"
+
+namespace tec {
+	namespace networking {
+		// Commands each client's buffer tries to keep queued, absorbing that much jitter at the
+		// cost of that many ticks of input latency.
+		extern std::size_t INPUT_BUFFER_TARGET_DEPTH;
+
+		struct InputBufferStats {
+			std::uint64_t underruns{ 0 }; // Ticks with nothing queued, so the last command was repeated.
+			std::uint64_t overruns{ 0 }; // Commands skipped because too many were queued.
+			std::uint64_t late{ 0 }; // Commands dropped on arrival as already consumed or duplicates.
+			std::uint64_t recovered{ 0 }; // Commands first received as a resend, their own message lost or late.
+			std::size_t depth{ 0 }; // Commands queued right now.
+		};
+
+		// Lines a client's commands up with the simulation's ticks. Commands are queued by command
+		// id as they arrive, however bursty, and exactly one is handed out per tick.
+		class InputBuffer {
+		public:
+			InputBuffer(std::size_t target_depth = INPUT_BUFFER_TARGET_DEPTH) : target_depth(target_depth) { }
+
+			// Queues a received command. Returns false if it was dropped as late or a duplicate.
+			// Resent copies (redundant) are expected to be duplicates so aren't counted as late.
+			bool Push(ClientCommandsEvent&& command, bool redundant = false);
+
+			// Gives out this tick's command. Once the buffer has first filled to the target depth
+			// the oldest queued command is taken. When it runs dry the last command is repeated
+			// until it has refilled, and when more than twice the target depth is queued the
+			// oldest are skipped down to the target. Returns false if no command has arrived yet.
+			bool Pop(ClientCommandsEvent& command);
+
+			void SetTargetDepth(std::size_t depth) {
+				this->target_depth = depth;
+			}
+
+			InputBufferStats GetStats() const {
+				InputBufferStats stats = this->stats;
+				stats.depth = this->commands.size();
+				return stats;
+			}
+		private:
+			std::size_t target_depth;
+			std::map<std::uint64_t, ClientCommandsEvent> commands; // Keyed by command id.
+			ClientCommandsEvent last_command;
+			bool has_last_command{ false };
+			bool filling{ true }; // Waiting to reach the target depth before consuming.
+			InputBufferStats stats;
+		};
+	}
+}
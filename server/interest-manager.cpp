@@ -0,0 +1,91 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "interest-manager.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tec {
+	namespace networking {
+		std::vector<InterestRule> DEFAULT_INTEREST_RULES = { { 50.0f, 1.0f }, { 150.0f, 0.25f } };
+
+		int InterestManager::GetCellCoord(float value) const {
+			return static_cast<int>(std::floor(value / this->cell_size));
+		}
+
+		// Packs 21 bits of each cell coordinate into one key.
+		std::uint64_t InterestManager::GetCellKey(int x, int y, int z) const {
+			const std::uint64_t mask = 0x1FFFFF;
+			return ((static_cast<std::uint64_t>(x) & mask) << 42) |
+				((static_cast<std::uint64_t>(y) & mask) << 21) |
+				(static_cast<std::uint64_t>(z) & mask);
+		}
+
+		void InterestManager::Update(const GameState& state) {
+			Clear();
+			for (const auto& position : state.positions) {
+				Add(position.first, position.second.value);
+			}
+		}
+
+		void InterestManager::Clear() {
+			// Keep the cell vectors around so their storage is reused next tick, but drop
+			// cells that were already empty so the grid doesn't grow with every cell ever visited.
+			for (auto cell = this->grid.begin(); cell != this->grid.end(); ) {
+				if (cell->second.empty()) {
+					cell = this->grid.erase(cell);
+				}
+				else {
+					cell->second.clear();
+					++cell;
+				}
+			}
+		}
+
+		void InterestManager::Add(eid entity_id, const glm::vec3& position) {
+			std::uint64_t key = GetCellKey(GetCellCoord(position.x), GetCellCoord(position.y), GetCellCoord(position.z));
+			this->grid[key].emplace_back(entity_id, position);
+		}
+
+		void InterestManager::Query(const glm::vec3& center, float radius, std::vector<eid>& out) const {
+			const float radius_squared = radius * radius;
+			const int min_x = GetCellCoord(center.x - radius), max_x = GetCellCoord(center.x + radius);
+			const int min_y = GetCellCoord(center.y - radius), max_y = GetCellCoord(center.y + radius);
+			const int min_z = GetCellCoord(center.z - radius), max_z = GetCellCoord(center.z + radius);
+			for (int x = min_x; x <= max_x; ++x) {
+				for (int y = min_y; y <= max_y; ++y) {
+					for (int z = min_z; z <= max_z; ++z) {
+						auto cell = this->grid.find(GetCellKey(x, y, z));
+						if (cell == this->grid.end()) {
+							continue;
+						}
+						for (const auto& entry : cell->second) {
+							glm::vec3 offset = entry.second - center;
+							if (glm::dot(offset, offset) <= radius_squared) {
+								out.push_back(entry.first);
+							}
+						}
+					}
+				}
+			}
+		}
+
+		float InterestManager::GetPriority(const std::vector<InterestRule>& rules, float distance) {
+			for (const InterestRule& rule : rules) {
+				if (distance <= rule.radius) {
+					return rule.priority;
+				}
+			}
+			return 0.0f;
+		}
+
+		float InterestManager::GetMaxRadius(const std::vector<InterestRule>& rules) {
+			float radius = 0.0f;
+			for (const InterestRule& rule : rules) {
+				radius = std::max(radius, rule.radius);
+			}
+			return radius;
+		}
+	}
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "types.hpp"
+#include "game-state.hpp"
+
+namespace tec {
+	namespace networking {
+		// One band of a client's area of interest. Entities closer than radius (and not in
+		// an inner band) are replicated with this priority.
+		struct InterestRule {
+			float radius;
+			float priority;
+		};
+
+		// Rules every client starts with, innermost band first.
+		extern std::vector<InterestRule> DEFAULT_INTEREST_RULES;
+
+		// Decides which entities each client is sent. Positions are bucketed into a uniform grid
+		// each tick so a query only looks at the cells around the client, which keeps the cost
+		// proportional to local density rather than world size.
+		class InterestManager {
+		public:
+			InterestManager(float cell_size = 32.0f) : cell_size(cell_size) { }
+
+			// Rebuilds the grid from this tick's positions.
+			void Update(const GameState& state);
+
+			// Empties the grid, for building it up with Add.
+			void Clear();
+
+			void Add(eid entity_id, const glm::vec3& position);
+
+			// Appends every entity within radius of center to out.
+			void Query(const glm::vec3& center, float radius, std::vector<eid>& out) const;
+
+			// Priority of an entity at distance under rules, or 0 if it is out of range.
+			static float GetPriority(const std::vector<InterestRule>& rules, float distance);
+
+			// Radius of the outermost band of rules.
+			static float GetMaxRadius(const std::vector<InterestRule>& rules);
+		private:
+			std::uint64_t GetCellKey(int x, int y, int z) const;
+			int GetCellCoord(float value) const;
+
+			float cell_size;
+			std::unordered_map<std::uint64_t, std::vector<std::pair<eid, glm::vec3>>> grid;
+		};
+	}
+}
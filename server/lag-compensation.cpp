@@ -0,0 +1,122 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "lag-compensation.hpp"
+
+#include <algorithm>
+
+#include "physics-system.hpp"
+
+namespace tec {
+	namespace networking {
+		std::size_t LAG_COMPENSATION_TICKS = 12;
+		state_id_t INTERPOLATION_DELAY_TICKS = 1;
+
+		void LagCompensator::Record(const GameState& state) {
+			if (this->history.size() != LAG_COMPENSATION_TICKS) {
+				this->history.resize(LAG_COMPENSATION_TICKS);
+				this->next_record = 0;
+			}
+			if (this->history.empty()) {
+				return;
+			}
+			TickRecord& record = this->history[this->next_record];
+			this->next_record = (this->next_record + 1) % this->history.size();
+			record.state_id = state.state_id;
+			record.bodies.clear(); // Keeps its storage for the next time round.
+			record.grid.Clear();
+			record.max_body_radius = 0.0f;
+			for (const auto& position : state.positions) {
+				BodyTransform body;
+				body.entity_id = position.first;
+				if (this->physics.GetBodyTransform(body.entity_id, body.position, body.orientation)) {
+					record.bodies[body.entity_id] = body;
+					record.grid.Add(body.entity_id, body.position);
+					record.max_body_radius = std::max(record.max_body_radius, this->physics.GetBodyRadius(body.entity_id));
+				}
+			}
+		}
+
+		state_id_t LagCompensator::GetViewStateID(state_id_t received_state_id) const {
+			return received_state_id > INTERPOLATION_DELAY_TICKS ? received_state_id - INTERPOLATION_DELAY_TICKS : 0;
+		}
+
+		eid LagCompensator::RayCast(state_id_t view_state_id, eid source, const glm::vec3& from, const glm::vec3& to,
+			glm::vec3* hit_point) {
+			// Everything the ray could touch is within half its length of its middle.
+			Rewind(view_state_id, source, (from + to) * 0.5f, glm::length(to - from) * 0.5f);
+			eid hit = this->physics.RayCast(from, to, source, hit_point);
+			Restore();
+			return hit;
+		}
+
+		void LagCompensator::Overlap(state_id_t view_state_id, eid source, const glm::vec3& center, float radius,
+			std::vector<eid>& out) {
+			Rewind(view_state_id, source, center, radius);
+			this->physics.Overlap(center, radius, source, out);
+			Restore();
+		}
+
+		const LagCompensator::TickRecord* LagCompensator::FindRecord(state_id_t view_state_id) const {
+			const TickRecord* view = nullptr;
+			for (const TickRecord& record : this->history) {
+				if (record.state_id == 0 || record.state_id > view_state_id) {
+					continue;
+				}
+				if (!view || record.state_id > view->state_id) {
+					view = &record;
+				}
+			}
+			if (!view) {
+				for (const TickRecord& record : this->history) {
+					if (record.state_id != 0 && (!view || record.state_id < view->state_id)) {
+						view = &record;
+					}
+				}
+			}
+			return view;
+		}
+
+		void LagCompensator::Rewind(state_id_t view_state_id, eid source, const glm::vec3& center, float radius) {
+			const TickRecord* view = FindRecord(view_state_id);
+			if (!view) {
+				return;
+			}
+			// Recorded after the last tick, so it holds where the bodies are now.
+			const TickRecord& now = this->history[(this->next_record + this->history.size() - 1) % this->history.size()];
+			// Bodies are recorded by their origin, so allow for the largest of them when deciding
+			// which ones the query could touch.
+			const float reach = radius + std::max(view->max_body_radius, now.max_body_radius);
+			// Those in reach then have to be moved back into it, and those in reach now out of it.
+			this->candidates.clear();
+			view->grid.Query(center, reach, this->candidates);
+			if (&now != view) {
+				now.grid.Query(center, reach, this->candidates);
+				std::sort(this->candidates.begin(), this->candidates.end());
+				this->candidates.erase(std::unique(this->candidates.begin(), this->candidates.end()), this->candidates.end());
+			}
+			for (eid entity_id : this->candidates) {
+				if (entity_id == source) {
+					continue;
+				}
+				auto body = view->bodies.find(entity_id);
+				if (body == view->bodies.end()) {
+					continue; // Had no body then, so there's nowhere to move it to.
+				}
+				BodyTransform current;
+				current.entity_id = entity_id;
+				if (this->physics.GetBodyTransform(current.entity_id, current.position, current.orientation)) {
+					this->saved.push_back(current);
+					this->physics.SetBodyTransform(entity_id, body->second.position, body->second.orientation);
+				}
+			}
+		}
+
+		void LagCompensator::Restore() {
+			for (const BodyTransform& body : this->saved) {
+				this->physics.SetBodyTransform(body.entity_id, body.position, body.orientation);
+			}
+			this->saved.clear();
+		}
+	}
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "types.hpp"
+#include "game-state.hpp"
+#include "interest-manager.hpp"
+
+namespace tec {
+	class PhysicsSystem;
+
+	namespace networking {
+		// How many ticks of body transforms are kept, and so how far back a query can rewind.
+		extern std::size_t LAG_COMPENSATION_TICKS;
+
+		// Ticks clients render behind the newest state they've received, while they interpolate
+		// towards it.
+		extern state_id_t INTERPOLATION_DELAY_TICKS;
+
+		// Answers hit queries against the world as a client saw it. Each tick's collision body
+		// transforms are recorded, and a query moves the bodies near it back to the tick the
+		// client was looking at, runs, and puts them back. Must be used from the simulation
+		// thread, between ticks. Nothing on the server makes hit queries yet. One acting on a
+		// client's command should pass GetViewStateID(event.state_id) of the ClientCommandsEvent
+		// that command was consumed in.
+		class LagCompensator {
+		public:
+			LagCompensator(PhysicsSystem& physics) : physics(physics) { }
+
+			// Records where every body is this tick. Call once per tick after simulating.
+			void Record(const GameState& state);
+
+			// The tick a client was looking at when it sent a command, given the newest state
+			// it had received then (the state id its ClientCommands message carries). The command
+			// id isn't needed: it only says which command this is, and the state id was stamped
+			// on the command when the client sent it, whatever tick the server applies it on.
+			state_id_t GetViewStateID(state_id_t received_state_id) const;
+
+			// RayCast as of view_state_id. source is never rewound or hit.
+			eid RayCast(state_id_t view_state_id, eid source, const glm::vec3& from, const glm::vec3& to,
+				glm::vec3* hit_point = nullptr);
+
+			// Overlap as of view_state_id. source is never rewound or included.
+			void Overlap(state_id_t view_state_id, eid source, const glm::vec3& center, float radius,
+				std::vector<eid>& out);
+		private:
+			struct BodyTransform {
+				eid entity_id;
+				glm::vec3 position;
+				glm::quat orientation;
+			};
+
+			struct TickRecord {
+				state_id_t state_id{ 0 };
+				std::unordered_map<eid, BodyTransform> bodies;
+				InterestManager grid; // Of the bodies' positions, so a query only looks at those near it.
+				float max_body_radius{ 0.0f }; // Of the largest collision shape recorded.
+			};
+
+			// The record for view_state_id, or the oldest one kept if it's further back than that.
+			// Null if nothing has been recorded.
+			const TickRecord* FindRecord(state_id_t view_state_id) const;
+
+			// Moves the bodies within radius of center, either as of view_state_id or now, back to
+			// view_state_id, saving where they are now. Bounded by the bodies in that radius.
+			void Rewind(state_id_t view_state_id, eid source, const glm::vec3& center, float radius);
+
+			// Puts every rewound body back.
+			void Restore();
+
+			PhysicsSystem& physics;
+			std::vector<TickRecord> history; // Ring buffer of LAG_COMPENSATION_TICKS records.
+			std::size_t next_record{ 0 };
+			std::vector<eid> candidates; // Scratch for the bodies a query could touch.
+			std::vector<BodyTransform> saved; // Current transforms of the bodies rewound.
+		};
+	}
+}
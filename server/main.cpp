@@ -1,6 +1,7 @@
 // Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
 // Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
 
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <chrono>
@@ -14,13 +15,18 @@
 #include "filesystem.hpp"
 #include "server.hpp"
 #include "client-connection.hpp"
+#include "interest-manager.hpp"
+#include "lag-compensation.hpp"
+#include "snapshot-delta.hpp"
+#include "scratch-arena.hpp"
 #include "game-state-queue.hpp"
 #include "simulation.hpp"
+#include "tick-scheduler.hpp"
+#include "tick-profiler.hpp"
+#include "worker-pool.hpp"
 
 using asio::ip::tcp;
 
-tec::state_id_t current_state_id = 0;
-
 namespace tec {
 	eid active_entity;
 	std::string LoadJSON(const FilePath& fname) {
@@ -47,65 +53,99 @@ namespace tec {
 }
 
 int main() {
-	std::chrono::high_resolution_clock::time_point last_time, next_time;
-	std::chrono::duration<double> elapsed_seconds;
-	bool closing = false;
-	double delta_accumulator = 0.0; // Accumulated deltas since the last update was sent.
-
 	tec::GameStateQueue game_state_queue;
 	tec::Simulation simulation;
+	tec::networking::InterestManager interest_manager;
+	tec::EncodedState encoded_state;
+	tec::ScratchArena tick_arena; // Every client's update for a tick, reset once the tick is sent.
+	tec::networking::LagCompensator lag_compensator(simulation.GetPhysicsSystem());
+	const auto tick_interval = std::chrono::duration_cast<tec::networking::TickScheduler::clock::duration>(
+		std::chrono::duration<double>(tec::UPDATE_RATE));
+	tec::networking::TickScheduler scheduler(tick_interval);
+	tec::networking::TickProfiler profiler(tick_interval);
+	tec::networking::WorkerPool snapshot_workers;
+	scheduler.SetReportHandler([] (const tec::networking::TickReport& report) {
+		if (report.overrun.count() > 0) {
+			typedef std::chrono::duration<double, std::milli> milliseconds;
+			std::cout << "Tick " << report.tick << " overran by " << milliseconds(report.overrun).count() << "ms (started "
+				<< milliseconds(report.jitter).count() << "ms late, took " << milliseconds(report.duration).count() << "ms)" << std::endl;
+		}
+	});
 
 	try {
 		tcp::endpoint endpoint(asio::ip::tcp::v4(), tec::networking::SERVER_PORT);
 		tec::networking::Server server(endpoint);
+		server.SetTickProfiler(&profiler);
 		std::cout << "Server ready" << std::endl;
 
 		tec::ProtoLoadEntity(tec::FilePath::GetAssetPath("json/1000.json"));
 
-		last_time = std::chrono::high_resolution_clock::now();
 		std::thread simulation_thread([&]() {
-			while (!closing) {
-				next_time = std::chrono::high_resolution_clock::now();
-				elapsed_seconds = next_time - last_time;
-				last_time = next_time;
-				delta_accumulator += elapsed_seconds.count();
-				if (delta_accumulator >= tec::UPDATE_RATE) {
-					current_state_id++;
-					game_state_queue.ProcessEventQueue();
-					tec::GameState full_state = simulation.Simulate(tec::UPDATE_RATE, game_state_queue.GetBaseState());
-					full_state.state_id = current_state_id;
-					tec::proto::GameStateUpdate full_state_update;
-					full_state_update.set_command_id(current_state_id);
-					full_state.Out(&full_state_update);
-					tec::networking::ServerMessage full_state_update_message;
-					full_state_update_message.SetStateID(current_state_id);
-					full_state_update_message.SetMessageType(tec::networking::MessageType::GAME_STATE_UPDATE);
-					full_state_update_message.SetBodyLength(full_state_update.ByteSize());
-					full_state_update.SerializeToArray(full_state_update_message.GetBodyPTR(), static_cast<int>(full_state_update_message.GetBodyLength()));
-					full_state_update_message.encode_header();
-					server.LockClientList();
-					for (std::shared_ptr<tec::networking::ClientConnection> client : server.GetClients()) {
-						client->UpdateGameState(full_state);
-						if (current_state_id - client->GetLastConfirmedStateID() > tec::TICKS_PER_SECOND * 2.0) {
-							server.Deliver(client, full_state_update_message);
-							std::cout << "sending full state " << current_state_id << " to: " << client->GetID() << " client state ID was: " << client->GetLastConfirmedStateID() << std::endl;
-						}
-						else {
-							server.Deliver(client, client->PrepareGameStateUpdateMessage(current_state_id));
-						}
+			scheduler.Run([&] (const tec::networking::TickInfo& tick) {
+				const tec::state_id_t current_state_id = static_cast<tec::state_id_t>(tick.tick);
+				profiler.BeginTick();
+				// Joins and leaves during the tick publish a new list, so this one needs no lock.
+				const std::shared_ptr<const tec::networking::ClientList> clients = server.GetClients();
+				server.ProcessLeaves(*clients);
+				server.ProcessEntityEvents();
+				game_state_queue.ProcessEventQueue();
+				// Exactly one command per client per tick, however they arrived.
+				for (const auto& client : *clients) {
+					client->ConsumeCommand();
+				}
+				profiler.EndPhase(tec::networking::TickPhase::EVENTS);
+				tec::GameState full_state = simulation.Simulate(tec::UPDATE_RATE, game_state_queue.GetBaseState());
+				full_state.state_id = current_state_id;
+				lag_compensator.Record(full_state);
+				profiler.EndPhase(tec::networking::TickPhase::SIMULATE);
+				if (tick.send_snapshot) {
+					interest_manager.Update(full_state);
+					// Quantized and packed once here, then shared by every client's update.
+					tec::EncodeState(full_state, encoded_state);
+				}
+				profiler.EndPhase(tec::networking::TickPhase::ENCODE);
+				// Each client's snapshot only reads the shared state and writes its own, so they are
+				// built in parallel and queued straight onto each connection. Building and sending
+				// are timed on every worker so the profile can tell them apart.
+				typedef tec::networking::TickProfiler::clock profile_clock;
+				std::atomic<profile_clock::rep> serialize_time{ 0 }, send_time{ 0 };
+				snapshot_workers.Run(clients->size(), [&] (std::size_t i) {
+					const std::shared_ptr<tec::networking::ClientConnection>& client = (*clients)[i];
+					const profile_clock::time_point start = profile_clock::now();
+					tec::networking::ServerMessage update_message;
+					bool has_update = false;
+					if (tick.send_snapshot) {
+						// Changes accumulate per client until confirmed, so this always covers every
+						// entity in the client's area of interest and no full state fallback is needed.
+						client->UpdateGameState(full_state, interest_manager);
+						has_update = client->PrepareGameStateUpdateMessage(current_state_id, encoded_state, tick_arena, update_message);
 					}
-
-					server.UnlockClientList();
-					delta_accumulator -= tec::UPDATE_RATE;
-					game_state_queue.SetBaseState(std::move(full_state));
+					const profile_clock::time_point serialized = profile_clock::now();
+					if (has_update) {
+						server.Deliver(client, update_message);
+					}
+					client->Flush(); // End of tick for this client, send everything queued for it.
+					serialize_time += (serialized - start).count();
+					send_time += (profile_clock::now() - serialized).count();
+				});
+				tick_arena.Reset();
+				game_state_queue.SetBaseState(std::move(full_state));
+				profiler.EndPhases(tec::networking::TickPhase::SERIALIZE, profile_clock::duration(serialize_time.load()),
+					tec::networking::TickPhase::SEND, profile_clock::duration(send_time.load()));
+				profiler.EndTick();
+				if (tec::networking::TICK_PROFILE_PRINT_INTERVAL_TICKS != 0 &&
+					tick.tick % tec::networking::TICK_PROFILE_PRINT_INTERVAL_TICKS == 0) {
+					std::cout << profiler.GetProfile().ToString() << std::endl;
 				}
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-			}
+			});
 		});
-		std::cout << "Starting time: " << last_time.time_since_epoch().count() << std::endl;
 		server.Start();
-		closing = true;
+		scheduler.Stop();
 		simulation_thread.join();
+		std::cout << profiler.GetProfile().ToString() << std::endl;
+		const tec::networking::TickSchedulerStats& stats = scheduler.GetStats();
+		std::cout << "Ticks: " << stats.ticks << ", overruns: " << stats.overruns << ", dropped: " << stats.dropped
+			<< ", max jitter: " << std::chrono::duration<double, std::milli>(stats.max_jitter).count() << "ms" << std::endl;
 	}
 	catch (std::exception& e) {
 		std::cerr << "Exception: " << e.what() << std::endl;
@@ -0,0 +1,33 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "prefab-cache.hpp"
+
+#include <fstream>
+#include <iostream>
+
+#include "filesystem.hpp"
+
+namespace tec {
+	namespace networking {
+		void LoadProtoPack(proto::Entity& entity, const FilePath& fname) {
+			if (fname.isValidPath() && fname.FileExists()) {
+				std::fstream input(fname.GetNativePath(), std::ios::in | std::ios::binary);
+				entity.ParseFromIstream(&input);
+			}
+			else {
+				std::cout << "error loading protopack " << fname.toString() << std::endl;
+			}
+		}
+
+		const proto::Entity& PrefabCache::Get(const std::string& path) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			auto itr = this->prefabs.find(path);
+			if (itr == this->prefabs.end()) {
+				itr = this->prefabs.emplace(path, proto::Entity()).first;
+				LoadProtoPack(itr->second, FilePath::GetAssetPath(path));
+			}
+			return itr->second;
+		}
+	}
+}
@@ -0,0 +1,30 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <components.pb.h>
+
+namespace tec {
+	class FilePath;
+
+	namespace networking {
+		// Parses each entity prefab (protopack) the first time it's asked for and hands out the
+		// parsed copy from then on, so nothing is read from disk while clients are joining.
+		class PrefabCache {
+		public:
+			// The prefab at path, relative to the assets directory. Missing or unreadable prefabs
+			// are logged once and come back empty.
+			const proto::Entity& Get(const std::string& path);
+		private:
+			std::mutex mutex;
+			std::unordered_map<std::string, proto::Entity> prefabs; // Never erased, so references stay valid.
+		};
+
+		void LoadProtoPack(proto::Entity& entity, const FilePath& fname);
+	}
+}
@@ -1,15 +1,14 @@
 // Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
 // Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
 
+#include <algorithm>
 #include <iostream>
-#include <fstream>
 #include <thread>
 
 #include <components.pb.h>
 
 #include "server.hpp"
 #include "client-connection.hpp"
-#include "filesystem.hpp"
 
 using asio::ip::tcp;
 
@@ -18,7 +17,16 @@ namespace tec {
 		unsigned short SERVER_PORT = 0xa10c;
 		std::mutex Server::recent_msgs_mutex;
 
-		Server::Server(tcp::endpoint& endpoint) : acceptor(io_service, endpoint), socket(io_service) {
+		Server::Server(tcp::endpoint& endpoint, std::size_t io_thread_count) : acceptor(io_service, endpoint) {
+			if (io_thread_count == 0) {
+				io_thread_count = std::max(1u, std::thread::hardware_concurrency());
+			}
+			for (std::size_t i = 0; i < io_thread_count; ++i) {
+				this->io_pool.push_back(std::make_unique<asio::io_context>());
+				this->io_pool_work.push_back(asio::make_work_guard(*this->io_pool.back()));
+			}
+			this->udp_socket = std::make_unique<udp::socket>(NextIOContext(), udp::endpoint(endpoint.address(), endpoint.port()));
+			UDPReceiveHandler();
 
 			// Create a simple greeting chat message that all clients get.
 			std::string message("Hello from server\n");
@@ -31,19 +39,19 @@ namespace tec {
 
 		// TODO: Implement a method to deliver a message to all clients except the source.
 		void Server::Deliver(const ServerMessage& msg, bool save_to_recent) {
+			// One copy shared by every client, and kept for later ones.
+			std::shared_ptr<const ServerMessage> shared_msg = std::make_shared<const ServerMessage>(msg);
 			if (save_to_recent) {
 				std::lock_guard<std::mutex> lock(recent_msgs_mutex);
-				this->recent_msgs.push_back(msg);
+				this->recent_msgs.push_back(shared_msg);
 				while (this->recent_msgs.size() > max_recent_msgs) {
 					this->recent_msgs.pop_front();
 				}
 			}
 
-			LockClientList();
-			for (auto client : this->clients) {
-				client->QueueWrite(msg);
+			for (const auto& client : *GetClients()) {
+				client->QueueWrite(shared_msg);
 			}
-			UnlockClientList();
 		}
 
 		void Server::Deliver(std::shared_ptr<ClientConnection> client, const ServerMessage& msg) {
@@ -51,106 +59,221 @@ namespace tec {
 		}
 
 		void Server::Leave(std::shared_ptr<ClientConnection> client) {
+			{
+				std::lock_guard<std::mutex> lock(this->client_list_mutex);
+				std::shared_ptr<const ClientList> current = GetClients();
+				auto itr = std::find(current->begin(), current->end(), client);
+				if (itr == current->end()) {
+					return; // Already left, a connection can fail on both its read and its write.
+				}
+				auto next = std::make_shared<ClientList>(current->begin(), itr);
+				next->insert(next->end(), itr + 1, current->end());
+				std::atomic_store(&this->clients, std::shared_ptr<const ClientList>(std::move(next)));
+			}
 			eid leaving_client_id = client->GetID();
 			client->DoLeave(); // Send out entity destroyed events and client leave messages.
+			{
+				std::lock_guard<std::mutex> lock(udp_connections_mutex);
+				this->udp_connections.erase(client->GetUDPConnectionID());
+			}
+			{
+				std::lock_guard<std::mutex> lock(entities_mutex);
+				this->client_entity_ids.erase(leaving_client_id);
+				this->entities.erase(leaving_client_id);
+			}
+			// Other clients are told on the next tick.
+			std::lock_guard<std::mutex> lock(this->left_clients_mutex);
+			this->left_clients.push_back(leaving_client_id);
+		}
 
-			LockClientList();
-			this->clients.erase(client);
-			UnlockClientList();
-
-			// Notify other clients that a client left.
-			for (auto _client : this->clients) {
-				_client->OnClientLeave(leaving_client_id);
+		void Server::ProcessLeaves(const ClientList& clients) {
+			std::vector<eid> left;
+			{
+				std::lock_guard<std::mutex> lock(this->left_clients_mutex);
+				left.swap(this->left_clients);
+			}
+			for (eid leaving_client_id : left) {
+				for (const auto& client : clients) {
+					client->OnClientLeave(leaving_client_id);
+				}
 			}
 		}
 
+		void Server::ProcessEntityEvents() {
+			std::lock_guard<std::mutex> lock(this->entity_events_mutex);
+			EventQueue<EntityCreated>::ProcessEventQueue();
+			EventQueue<EntityDestroyed>::ProcessEventQueue();
+		}
+
 		void Server::Start() {
+			for (auto& context : this->io_pool) {
+				asio::io_context* io_context = context.get();
+				this->io_pool_threads.emplace_back([io_context] () {
+					io_context->run();
+				});
+			}
 			this->io_service.run();
+			for (auto& thread : this->io_pool_threads) {
+				thread.join();
+			}
+			this->io_pool_threads.clear();
 		}
 
 		void Server::Stop() {
-			LockClientList();
-			this->clients.clear();
-			UnlockClientList();
+			{
+				std::lock_guard<std::mutex> lock(this->client_list_mutex);
+				std::atomic_store(&this->clients, std::make_shared<const ClientList>());
+			}
 			this->io_service.stop();
+			for (auto& context : this->io_pool) {
+				context->stop();
+			}
+		}
+
+		void Server::SendDatagram(const udp::endpoint& endpoint, const char* data, std::size_t length) {
+			std::lock_guard<std::mutex> lock(udp_send_mutex);
+			std::error_code error;
+			this->udp_socket->send_to(asio::buffer(data, length), endpoint, 0, error);
+		}
+
+		void Server::UDPReceiveHandler() {
+			this->udp_socket->async_receive_from(
+				asio::buffer(this->udp_recv_buffer), this->udp_remote_endpoint,
+				[this] (std::error_code error, std::size_t length) {
+					if (error == asio::error::operation_aborted) {
+						return;
+					}
+					std::uint32_t connection_id;
+					if (!error && ReliableChannel::PeekConnectionID(this->udp_recv_buffer, length, connection_id)) {
+						std::shared_ptr<ClientConnection> client;
+						{
+							std::lock_guard<std::mutex> lock(udp_connections_mutex);
+							auto itr = this->udp_connections.find(connection_id);
+							if (itr != this->udp_connections.end()) {
+								client = itr->second.lock();
+							}
+						}
+						if (client) {
+							client->ReceiveDatagram(this->udp_recv_buffer, length, this->udp_remote_endpoint);
+						}
+					}
+					UDPReceiveHandler();
+				});
+		}
+
+		asio::io_context& Server::NextIOContext() {
+			asio::io_context& io_context = *this->io_pool[this->next_io_context];
+			this->next_io_context = (this->next_io_context + 1) % this->io_pool.size();
+			return io_context;
 		}
 
-		void LoadProtoPack(proto::Entity& entity, const FilePath& fname) {
-			if (fname.isValidPath() && fname.FileExists()) {
-				std::fstream input(fname.GetNativePath(), std::ios::in | std::ios::binary);
-				entity.ParseFromIstream(&input);
+		void Server::CacheEntityCreate(const proto::Entity& entity) {
+			std::shared_ptr<ServerMessage> msg = std::make_shared<ServerMessage>();
+			msg->SetBodyLength(entity.ByteSize());
+			entity.SerializeToArray(msg->GetBodyPTR(), static_cast<int>(msg->GetBodyLength()));
+			msg->SetMessageType(MessageType::ENTITY_CREATE);
+			msg->encode_header();
+			CachedEntity& cached = this->entities[entity.id()];
+			cached.create_msg = msg;
+			cached.compressed_create_msg = msg;
+			if (MESSAGE_COMPRESSION) {
+				std::shared_ptr<ServerMessage> compressed = std::make_shared<ServerMessage>(*msg);
+				if (this->entity_compressor.Compress(*compressed)) {
+					cached.compressed_create_msg = compressed;
+				}
 			}
-			else {
-				std::cout << "error loading protopack " << fname.toString() << std::endl;
+			cached.positioned = false;
+			for (const proto::Component& component : entity.components()) {
+				cached.positioned = cached.positioned || component.has_position();
 			}
 		}
 
+		bool Server::GetEntityCreateMessage(eid entity_id, QueuedMessage& msg) {
+			std::lock_guard<std::mutex> lock(entities_mutex);
+			auto itr = this->entities.find(entity_id);
+			if (itr == this->entities.end()) {
+				return false;
+			}
+			msg.msg = itr->second.create_msg;
+			msg.compressed = itr->second.compressed_create_msg;
+			return true;
+		}
+
 		void Server::On(std::shared_ptr<EntityCreated> data) {
-			this->entities[data->entity_id] = data->entity;
+			std::lock_guard<std::mutex> lock(entities_mutex);
+			if (this->client_entity_ids.count(data->entity_id)) {
+				return; // Already cached as the others protopack.
+			}
+			CacheEntityCreate(data->entity);
 		}
 
 		void Server::On(std::shared_ptr<EntityDestroyed> data) {
+			std::lock_guard<std::mutex> lock(entities_mutex);
 			this->entities.erase(data->entity_id);
+			this->client_entity_ids.erase(data->entity_id);
 		}
 
 		void Server::AcceptHandler() {
+			// The new socket is bound to one of the pool contexts so all of the connection's
+			// reads and writes run there, off the accept thread.
 			acceptor.async_accept(
-				socket,
-				[this] (std::error_code error) {
-					EventQueue<EntityCreated>::ProcessEventQueue();
-					EventQueue<EntityDestroyed>::ProcessEventQueue();
+				NextIOContext(),
+				[this] (std::error_code error, tcp::socket socket) {
+					ProcessEntityEvents(); // So the joiner is sent everything created up to now.
 					if (!error) {
 						asio::write(socket, asio::buffer(greeting_msg.GetDataPTR(), greeting_msg.length()));
 						std::shared_ptr<ClientConnection> client = std::make_shared<ClientConnection>(std::move(socket), this);
 
-						// self_protopack does contain a renderable component
-						static FilePath others_protopack = FilePath::GetAssetPath("protopacks/others.proto");
-						proto::Entity other_entity;
-						LoadProtoPack(other_entity, others_protopack);
-
 						client->SetID(++base_id);
+						std::uint32_t udp_connection_id;
+						{
+							std::lock_guard<std::mutex> lock(udp_connections_mutex);
+							do {
+								udp_connection_id = this->udp_connection_id_generator();
+							} while (udp_connection_id == 0 || this->udp_connections.count(udp_connection_id));
+							this->udp_connections[udp_connection_id] = client;
+						}
+						client->SetUDPConnectionID(udp_connection_id);
 						client->DoJoin();
 
-						static ServerMessage connecting_client_entity_msg;
-						other_entity.set_id(client->GetID());
-						connecting_client_entity_msg.SetBodyLength(other_entity.ByteSize());
-						other_entity.SerializeToArray(connecting_client_entity_msg.GetBodyPTR(), static_cast<int>(connecting_client_entity_msg.GetBodyLength()));
-						connecting_client_entity_msg.SetMessageType(MessageType::ENTITY_CREATE);
-						connecting_client_entity_msg.encode_header();
-
-						static ServerMessage other_client_entity_msg;
-						for (auto other_client : clients) {
-							other_entity.set_id(other_client->GetID());
-							other_client_entity_msg.SetBodyLength(other_entity.ByteSize());
-							other_entity.SerializeToArray(other_client_entity_msg.GetBodyPTR(), static_cast<int>(other_client_entity_msg.GetBodyLength()));
-							other_client_entity_msg.SetMessageType(MessageType::ENTITY_CREATE);
-							other_client_entity_msg.encode_header();
-
-							client->QueueWrite(other_client_entity_msg);
-							other_client->QueueWrite(connecting_client_entity_msg);
+						// Only the client's own entity has been sent so far. The rest of the world is
+						// streamed in by interest management over the next ticks, nearest first and
+						// interleaved with updates. Entities without a position are always relevant.
+						{
+							// Other clients are shown with the others protopack, which contains a
+							// renderable component.
+							proto::Entity other_entity = this->prefabs.Get("protopacks/others.proto");
+							other_entity.set_id(client->GetID());
+							std::vector<eid> static_entities;
+							std::lock_guard<std::mutex> lock(entities_mutex);
+							this->client_entity_ids.insert(client->GetID());
+							CacheEntityCreate(other_entity);
+							for (auto& entity : this->entities) {
+								// Clients move about even if their prefab has no position.
+								if (!entity.second.positioned && !this->client_entity_ids.count(entity.first)) {
+									static_entities.push_back(entity.first);
+								}
+							}
+							client->SetStaticEntities(std::move(static_entities));
 						}
-						for (auto entity : entities) {
-							other_client_entity_msg.SetBodyLength(entity.second.ByteSize());
-							entity.second.SerializeToArray(other_client_entity_msg.GetBodyPTR(), static_cast<int>(other_client_entity_msg.GetBodyLength()));
-							other_client_entity_msg.SetMessageType(MessageType::ENTITY_CREATE);
-							other_client_entity_msg.encode_header();
 
-							client->QueueWrite(other_client_entity_msg);
+						{
+							std::lock_guard<std::mutex> lock(this->client_list_mutex);
+							auto next = std::make_shared<ClientList>(*GetClients());
+							next->push_back(client);
+							std::atomic_store(&this->clients, std::shared_ptr<const ClientList>(std::move(next)));
 						}
-
-						LockClientList();
-						clients.insert(client);
-						UnlockClientList();
 						{
 							std::lock_guard<std::mutex> lock(recent_msgs_mutex);
-							for (auto msg : this->recent_msgs) {
+							for (const auto& msg : this->recent_msgs) {
 								client->QueueWrite(msg);
 							}
 						}
+						// Send the client its id and entity now rather than waiting for the next tick.
+						client->Flush();
 						client->StartRead();
 					}
 
-					std::this_thread::sleep_for(std::chrono::milliseconds(1));
 					AcceptHandler();
 				});
 		}
@@ -5,26 +5,44 @@
 
 #include <set>
 #include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <asio.hpp>
 #include <components.pb.h>
 
 #include "server-message.hpp"
+#include "reliable-channel.hpp"
+#include "message-compression.hpp"
+#include "prefab-cache.hpp"
 #include "event-queue.hpp"
 #include "event-system.hpp"
 #include "events.hpp"
 
 using asio::ip::tcp;
+using asio::ip::udp;
 
 namespace tec {
 	namespace networking {
 		extern unsigned short SERVER_PORT;
 		class ClientConnection;
+		class TickProfiler;
+		struct QueuedMessage;
+
+		// A version of the connected clients. Never changed once published, so it can be iterated
+		// without a lock for as long as it is held.
+		typedef std::vector<std::shared_ptr<ClientConnection>> ClientList;
 
 		class Server : public EventQueue<EntityCreated>, public EventQueue<EntityDestroyed> {
 		public:
-			Server(tcp::endpoint& endpoint);
+			// io_thread_count is the number of threads (each with its own io_context) that
+			// connections are spread over; 0 uses one per core. Accepts get their own context.
+			Server(tcp::endpoint& endpoint, std::size_t io_thread_count = 0);
 
 			// Deliver a message to all clients.
 			// save_to_recent is used to save a recent list of message each client gets when they connect.
@@ -36,22 +54,44 @@ namespace tec {
 			// Calls when a client leaves, usually when the connection is no longer valid.
 			void Leave(std::shared_ptr<ClientConnection> client);
 
+			// Sends a datagram from the server's UDP socket, which listens on the same port as TCP.
+			void SendDatagram(const udp::endpoint& endpoint, const char* data, std::size_t length);
+
+			// Runs the connection io_context pool and then the acceptor on the calling thread
+			// until Stop() is called.
 			void Start();
 
 			void Stop();
 
-			void LockClientList() {
-				this->client_list_mutex.lock();
+			// The clients connected right now. Joins and leaves publish a new list rather than
+			// changing this one, so the caller can keep using it while they happen.
+			std::shared_ptr<const ClientList> GetClients() const {
+				return std::atomic_load(&this->clients);
 			}
 
-			void UnlockClientList() {
-				
-				this->client_list_mutex.unlock();
+			// Tells each of clients about every client that has left since the last call, so they
+			// stop being sent its state. Leaves are only recorded by Leave() as it can run on any io
+			// thread, while a client's area of interest belongs to the tick. Call once per tick,
+			// before any snapshots are built.
+			void ProcessLeaves(const ClientList& clients);
+
+			// Caches the ENTITY_CREATE of every entity created, and drops every entity destroyed,
+			// since the last call. Interest management can only send entities cached here, so call
+			// once per tick before any snapshots are built. Joins also call it.
+			void ProcessEntityEvents();
+
+			// Gets the cached ENTITY_CREATE message sent to a client when entity_id enters its area
+			// of interest. Returns false if the entity isn't known to the server.
+			bool GetEntityCreateMessage(eid entity_id, QueuedMessage& msg);
+
+			// Where SERVER_STATS requests are answered from. May be null. Set before Start(), and
+			// must outlive the server.
+			void SetTickProfiler(const TickProfiler* profiler) {
+				this->tick_profiler = profiler;
 			}
 
-			// Get a list of all connected clients.
-			const std::set<std::shared_ptr<ClientConnection>>& GetClients() {
-				return this->clients;
+			const TickProfiler* GetTickProfiler() const {
+				return this->tick_profiler;
 			}
 
 			void On(std::shared_ptr<EntityCreated> data);
@@ -59,24 +99,62 @@ namespace tec {
 		private:
 			// Method that handles and accepts incoming connections.
 			void AcceptHandler();
-			
+
+			// Receives datagrams and hands each to the connection its connection id belongs to.
+			void UDPReceiveHandler();
+
+			// Picks the io_context for the next connection, round-robin.
+			asio::io_context& NextIOContext();
+
+			// Serializes entity into its cached ENTITY_CREATE message, compressed as well if that
+			// helps. Must be called with entities_mutex held.
+			void CacheEntityCreate(const proto::Entity& entity);
+
 			// ASIO variables
-			asio::io_service io_service;
+			asio::io_service io_service; // Only runs the acceptor.
 			tcp::acceptor acceptor;
-			tcp::socket socket;
+			std::vector<std::unique_ptr<asio::io_context>> io_pool; // Connection contexts, one thread each.
+			std::vector<asio::executor_work_guard<asio::io_context::executor_type>> io_pool_work;
+			std::vector<std::thread> io_pool_threads;
+			std::size_t next_io_context{ 0 };
+
+			// UDP channel. Connection ids are random so they can't be guessed from client ids.
+			std::unique_ptr<udp::socket> udp_socket;
+			udp::endpoint udp_remote_endpoint;
+			char udp_recv_buffer[ReliableChannel::max_packet_size];
+			std::mutex udp_send_mutex;
+			std::unordered_map<std::uint32_t, std::weak_ptr<ClientConnection>> udp_connections;
+			std::mutex udp_connections_mutex;
+			std::mt19937 udp_connection_id_generator{ std::random_device()() };
 
 			ServerMessage greeting_msg; // Greeting chat message.
 
-			std::map<eid, proto::Entity> entities;
-
-			std::set<std::shared_ptr<ClientConnection>> clients; // All connected clients.
+			PrefabCache prefabs;
+			// Every entity's ENTITY_CREATE, serialized once when it is created and shared by every
+			// client it is sent to, so joins and entities coming into view cost no serialization.
+			struct CachedEntity {
+				std::shared_ptr<const ServerMessage> create_msg;
+				std::shared_ptr<const ServerMessage> compressed_create_msg;
+				bool positioned{ false }; // Sent by interest management rather than on join.
+			};
+			std::map<eid, CachedEntity> entities;
+			std::set<eid> client_entity_ids; // Sent to other clients as the others protopack.
+			MessageCompressor entity_compressor;
+			std::mutex entities_mutex; // Guards entities, client_entity_ids and entity_compressor.
+			std::mutex entity_events_mutex; // The event queues can only be processed by one thread at a time.
+
+			const TickProfiler* tick_profiler{ nullptr };
+
+			std::shared_ptr<const ClientList> clients{ std::make_shared<const ClientList>() }; // Read and replaced atomically.
+			std::mutex client_list_mutex; // Only held to publish a new client list.
+			std::vector<eid> left_clients; // Not yet passed to ProcessLeaves().
+			std::mutex left_clients_mutex;
 			std::uint64_t base_id = 10000; // Starting client_id
 
 			// Recent message list all clients get on connecting,
 			enum { max_recent_msgs = 100 };
-			std::deque<ServerMessage> recent_msgs;
+			std::deque<std::shared_ptr<const ServerMessage>> recent_msgs;
 			static std::mutex recent_msgs_mutex;
-			std::mutex client_list_mutex;
 		};
 	}
 }
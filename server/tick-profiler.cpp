@@ -0,0 +1,121 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "tick-profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace tec {
+	namespace networking {
+		std::size_t TICK_PROFILE_WINDOW = 600; // A minute at the default tick rate.
+		std::uint64_t TICK_PROFILE_PRINT_INTERVAL_TICKS = 600;
+
+		static const std::size_t phase_count = static_cast<std::size_t>(TickPhase::COUNT);
+
+		const char* GetTickPhaseName(TickPhase phase) {
+			switch (phase) {
+				case TickPhase::EVENTS:
+				return "events";
+				case TickPhase::SIMULATE:
+				return "simulate";
+				case TickPhase::ENCODE:
+				return "encode";
+				case TickPhase::SERIALIZE:
+				return "serialize";
+				case TickPhase::SEND:
+				return "send";
+				case TickPhase::TOTAL:
+				return "total";
+				default:
+				return "";
+			}
+		}
+
+		std::string TickProfile::ToString() const {
+			std::string out;
+			char line[96];
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				std::snprintf(line, sizeof(line), "%-9s p50 %7.2fms p99 %7.2fms max %7.2fms\n",
+					GetTickPhaseName(static_cast<TickPhase>(i)), this->phases[i].p50, this->phases[i].p99, this->phases[i].max);
+				out += line;
+			}
+			std::snprintf(line, sizeof(line), "%llu ticks, %llu over budget",
+				static_cast<unsigned long long>(this->ticks), static_cast<unsigned long long>(this->over_budget));
+			out += line;
+			return out;
+		}
+
+		TickProfiler::TickProfiler(clock::duration budget, std::size_t window) :
+			budget(budget), window(std::max<std::size_t>(window, 1)) {
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				this->current[i] = clock::duration::zero();
+				this->samples[i].reserve(this->window);
+			}
+		}
+
+		void TickProfiler::BeginTick() {
+			this->tick_start = this->phase_start = this->now();
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				this->current[i] = clock::duration::zero();
+			}
+		}
+
+		void TickProfiler::EndPhase(TickPhase phase) {
+			const clock::time_point end = this->now();
+			this->current[static_cast<std::size_t>(phase)] += end - this->phase_start;
+			this->phase_start = end;
+		}
+
+		void TickProfiler::EndPhases(TickPhase first, clock::duration first_time, TickPhase second, clock::duration second_time) {
+			const clock::time_point end = this->now();
+			const clock::duration elapsed = end - this->phase_start;
+			const clock::duration summed = first_time + second_time;
+			const clock::duration first_share = summed.count() > 0 ? std::chrono::duration_cast<clock::duration>(
+				elapsed * (static_cast<double>(first_time.count()) / summed.count())) : clock::duration::zero();
+			this->current[static_cast<std::size_t>(first)] += first_share;
+			this->current[static_cast<std::size_t>(second)] += elapsed - first_share;
+			this->phase_start = end;
+		}
+
+		void TickProfiler::EndTick() {
+			this->current[static_cast<std::size_t>(TickPhase::TOTAL)] = this->now() - this->tick_start;
+			std::lock_guard<std::mutex> lock(this->samples_mutex);
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				if (this->samples[i].size() < this->window) {
+					this->samples[i].push_back(this->current[i]);
+				}
+				else {
+					this->samples[i][this->next_sample] = this->current[i];
+				}
+			}
+			this->next_sample = (this->next_sample + 1) % this->window;
+			++this->ticks;
+			if (this->current[static_cast<std::size_t>(TickPhase::TOTAL)] > this->budget) {
+				++this->over_budget;
+			}
+		}
+
+		TickProfile TickProfiler::GetProfile() const {
+			typedef std::chrono::duration<double, std::milli> milliseconds;
+			TickProfile profile;
+			std::vector<clock::duration> sorted;
+			std::lock_guard<std::mutex> lock(this->samples_mutex);
+			profile.ticks = this->ticks;
+			profile.over_budget = this->over_budget;
+			for (std::size_t i = 0; i < phase_count; ++i) {
+				if (this->samples[i].empty()) {
+					continue;
+				}
+				sorted = this->samples[i];
+				std::sort(sorted.begin(), sorted.end());
+				// Each percentile rounded down to a sample.
+				const std::size_t last = sorted.size() - 1;
+				profile.phases[i].p50 = milliseconds(sorted[last * 50 / 100]).count();
+				profile.phases[i].p99 = milliseconds(sorted[last * 99 / 100]).count();
+				profile.phases[i].max = milliseconds(sorted[last]).count();
+			}
+			return profile;
+		}
+	}
+}
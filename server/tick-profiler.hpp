@@ -0,0 +1,97 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tec {
+	namespace networking {
+		// How many of the most recent ticks percentiles are taken over.
+		extern std::size_t TICK_PROFILE_WINDOW;
+
+		// The profile is printed every this many ticks, or never if 0.
+		extern std::uint64_t TICK_PROFILE_PRINT_INTERVAL_TICKS;
+
+		// The stages of a server tick, in the order they run.
+		enum class TickPhase {
+			EVENTS, // Queued events and each client's command for the tick.
+			SIMULATE, // Simulation and lag compensation.
+			ENCODE, // Interest grid and the state encoded once for all clients.
+			SERIALIZE, // Each client's update built and serialized.
+			SEND, // Each client's update delivered and flushed.
+			TOTAL, // The whole tick.
+			COUNT,
+		};
+
+		const char* GetTickPhaseName(TickPhase phase);
+
+		// In milliseconds, over the last TICK_PROFILE_WINDOW ticks.
+		struct PhaseProfile {
+			double p50{ 0.0 };
+			double p99{ 0.0 };
+			double max{ 0.0 };
+		};
+
+		struct TickProfile {
+			PhaseProfile phases[static_cast<std::size_t>(TickPhase::COUNT)];
+			std::uint64_t ticks{ 0 }; // Since the server started.
+			std::uint64_t over_budget{ 0 }; // Ticks that took longer than the tick budget, since the server started.
+
+			const PhaseProfile& Get(TickPhase phase) const {
+				return this->phases[static_cast<std::size_t>(phase)];
+			}
+
+			// One line per phase, for logs and SERVER_STATS replies.
+			std::string ToString() const;
+		};
+
+		// Times each phase of every tick. The simulation thread marks the end of each phase as it
+		// goes, and the profile can be read from any thread.
+		class TickProfiler {
+		public:
+			typedef std::chrono::steady_clock clock;
+
+			TickProfiler(clock::duration budget, std::size_t window = TICK_PROFILE_WINDOW);
+
+			// Replaces clock::now, e.g. with a clock a test advances by hand. Set it before the
+			// first tick.
+			void SetClock(std::function<clock::time_point()> now) {
+				this->now = std::move(now);
+			}
+
+			void BeginTick();
+
+			// Charges the time since the tick began, or since the last phase ended, to phase.
+			void EndPhase(TickPhase phase);
+
+			// As EndPhase, for two phases that ran interleaved, e.g. on worker threads. The time is
+			// split between them in proportion to how long each took summed over the threads.
+			void EndPhases(TickPhase first, clock::duration first_time, TickPhase second, clock::duration second_time);
+
+			// Records the tick's total and its phases. Phases not ended this tick count as 0.
+			void EndTick();
+
+			// Percentiles are only worked out here, so this costs a sort per phase.
+			TickProfile GetProfile() const;
+		private:
+			clock::duration budget;
+			std::size_t window;
+			std::function<clock::time_point()> now{ &clock::now };
+			clock::time_point tick_start, phase_start;
+			clock::duration current[static_cast<std::size_t>(TickPhase::COUNT)];
+
+			mutable std::mutex samples_mutex; // Guards everything below.
+			// Ring buffers of the last window ticks, one per phase.
+			std::vector<clock::duration> samples[static_cast<std::size_t>(TickPhase::COUNT)];
+			std::size_t next_sample{ 0 };
+			std::uint64_t ticks{ 0 };
+			std::uint64_t over_budget{ 0 };
+		};
+	}
+}
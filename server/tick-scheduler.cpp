@@ -0,0 +1,101 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "tick-scheduler.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+#endif
+
+namespace tec {
+	namespace networking {
+		std::uint32_t MAX_TICKS_PER_WAKEUP = 4;
+		std::uint32_t SNAPSHOT_INTERVAL_TICKS = 1;
+
+		TickScheduler::TickScheduler(clock::duration interval, std::uint32_t snapshot_interval,
+			std::uint32_t max_ticks_per_wakeup) : interval(interval),
+			snapshot_interval(std::max<std::uint32_t>(snapshot_interval, 1)),
+			max_ticks_per_wakeup(std::max<std::uint32_t>(max_ticks_per_wakeup, 1)) {
+#if defined(__linux__)
+			// steady_clock is CLOCK_MONOTONIC, so its time points can be used as absolute expiry times.
+			this->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#endif
+		}
+
+		TickScheduler::~TickScheduler() {
+#if defined(__linux__)
+			if (this->timer_fd != -1) {
+				close(this->timer_fd);
+			}
+#endif
+		}
+
+		void TickScheduler::WaitUntil(clock::time_point deadline) {
+#if defined(__linux__)
+			if (this->timer_fd != -1) {
+				const auto since_epoch = deadline.time_since_epoch();
+				const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+				itimerspec spec{ };
+				spec.it_value.tv_sec = static_cast<time_t>(seconds.count());
+				spec.it_value.tv_nsec = static_cast<long>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - seconds).count());
+				if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+					spec.it_value.tv_nsec = 1; // All zeros would disarm the timer instead.
+				}
+				if (timerfd_settime(this->timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+					std::uint64_t expirations;
+					while (read(this->timer_fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR) { }
+					return;
+				}
+			}
+#endif
+			std::this_thread::sleep_until(deadline);
+		}
+
+		void TickScheduler::Run(const std::function<void(const TickInfo&)>& tick) {
+			std::uint64_t tick_number = 0;
+			clock::time_point deadline = clock::now() + this->interval;
+			while (!this->stopped) {
+				WaitUntil(deadline);
+				// Run every tick that is due, up to the cap, each against its own deadline.
+				std::uint32_t ran = 0;
+				clock::time_point now = clock::now();
+				while (now >= deadline && ran < this->max_ticks_per_wakeup && !this->stopped) {
+					TickInfo info;
+					info.tick = ++tick_number;
+					info.send_snapshot = info.tick % this->snapshot_interval == 0;
+					TickReport report;
+					report.tick = info.tick;
+					report.jitter = now - deadline;
+					tick(info);
+					const clock::time_point end = clock::now();
+					report.duration = end - now;
+					deadline += this->interval;
+					if (end > deadline) {
+						report.overrun = end - deadline;
+						++this->stats.overruns;
+					}
+					++this->stats.ticks;
+					this->stats.max_jitter = std::max(this->stats.max_jitter, report.jitter);
+					if (this->report_handler) {
+						this->report_handler(report);
+					}
+					++ran;
+					now = end;
+				}
+				// Still behind after the cap, so skip to the next deadline still ahead of us.
+				if (now >= deadline) {
+					const std::uint64_t behind = static_cast<std::uint64_t>((now - deadline) / this->interval) + 1;
+					deadline += this->interval * behind;
+					this->stats.dropped += behind;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace tec {
+	namespace networking {
+		// Most ticks run back to back when the scheduler has fallen behind. Any more than that are
+		// dropped, so a long stall doesn't turn into a burst that makes things worse.
+		extern std::uint32_t MAX_TICKS_PER_WAKEUP;
+
+		// A snapshot is sent to clients every this many simulation ticks.
+		extern std::uint32_t SNAPSHOT_INTERVAL_TICKS;
+
+		struct TickInfo {
+			std::uint64_t tick{ 0 }; // Starts at 1. Dropped ticks aren't counted, so ticks run are numbered without gaps.
+			bool send_snapshot{ false }; // Whether this tick should send clients a snapshot.
+		};
+
+		// How a tick went, reported once it has run.
+		struct TickReport {
+			std::uint64_t tick{ 0 };
+			std::chrono::steady_clock::duration jitter{ 0 }; // How late the tick started.
+			std::chrono::steady_clock::duration duration{ 0 }; // How long it took to run.
+			std::chrono::steady_clock::duration overrun{ 0 }; // How far past the next tick's deadline it ended.
+		};
+
+		struct TickSchedulerStats {
+			std::uint64_t ticks{ 0 }; // Ticks run.
+			std::uint64_t overruns{ 0 }; // Ticks that ended past the next tick's deadline.
+			std::uint64_t dropped{ 0 }; // Ticks skipped to catch up.
+			std::chrono::steady_clock::duration max_jitter{ 0 };
+		};
+
+		// Runs a tick at a fixed cadence against absolute deadlines, so time spent in a tick or
+		// oversleeping never accumulates as drift. Waits on a timerfd on Linux and sleeps until
+		// the deadline elsewhere.
+		class TickScheduler {
+		public:
+			typedef std::chrono::steady_clock clock;
+
+			TickScheduler(clock::duration interval, std::uint32_t snapshot_interval = SNAPSHOT_INTERVAL_TICKS,
+				std::uint32_t max_ticks_per_wakeup = MAX_TICKS_PER_WAKEUP);
+			~TickScheduler();
+
+			TickScheduler(const TickScheduler&) = delete;
+			TickScheduler& operator=(const TickScheduler&) = delete;
+
+			// Called after every tick.
+			void SetReportHandler(std::function<void(const TickReport&)> handler) {
+				this->report_handler = std::move(handler);
+			}
+
+			// Calls tick once per interval until Stop is called, starting one interval from now.
+			void Run(const std::function<void(const TickInfo&)>& tick);
+
+			// Makes Run return once the tick in progress, or the wait for the next, is over.
+			// Safe to call from any thread.
+			void Stop() {
+				this->stopped = true;
+			}
+
+			// Only safe to read from the thread calling Run, or once it has returned.
+			const TickSchedulerStats& GetStats() const {
+				return this->stats;
+			}
+		private:
+			// Blocks until deadline, or returns straight away if it has passed.
+			void WaitUntil(clock::time_point deadline);
+
+			clock::duration interval;
+			std::uint32_t snapshot_interval;
+			std::uint32_t max_ticks_per_wakeup;
+			std::atomic<bool> stopped{ false };
+			std::function<void(const TickReport&)> report_handler;
+			TickSchedulerStats stats;
+			int timer_fd{ -1 };
+		};
+	}
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "worker-pool.hpp"
+
+#include <algorithm>
+
+namespace tec {
+	namespace networking {
+		std::size_t SNAPSHOT_WORKER_THREADS = 0;
+
+		WorkerPool::WorkerPool(std::size_t thread_count) {
+			if (thread_count == 0) {
+				thread_count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+			}
+			for (std::size_t i = 0; i < thread_count; ++i) {
+				this->threads.emplace_back([this] () {
+					WorkerLoop();
+				});
+			}
+		}
+
+		WorkerPool::~WorkerPool() {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->stopping = true;
+			}
+			this->batch_started.notify_all();
+			for (auto& thread : this->threads) {
+				thread.join();
+			}
+		}
+
+		void WorkerPool::Run(std::size_t count, const std::function<void(std::size_t)>& job) {
+			if (this->threads.empty() || count <= 1) {
+				for (std::size_t i = 0; i < count; ++i) {
+					job(i);
+				}
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->job = &job;
+				this->job_count = count;
+				this->next_job = 0;
+				this->busy_workers = this->threads.size();
+				++this->batch;
+			}
+			this->batch_started.notify_all();
+			Work();
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->batch_finished.wait(lock, [this] () {
+				return this->busy_workers == 0;
+			});
+			this->job = nullptr;
+		}
+
+		void WorkerPool::WorkerLoop() {
+			std::uint64_t last_batch = 0;
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lock(this->mutex);
+					this->batch_started.wait(lock, [this, last_batch] () {
+						return this->stopping || this->batch != last_batch;
+					});
+					if (this->stopping) {
+						return;
+					}
+					last_batch = this->batch;
+				}
+				Work();
+				std::lock_guard<std::mutex> lock(this->mutex);
+				if (--this->busy_workers == 0) {
+					this->batch_finished.notify_one();
+				}
+			}
+		}
+
+		void WorkerPool::Work() {
+			// job and job_count were set under the lock before the batch started, and don't change
+			// until every worker has finished it.
+			for (std::size_t i = this->next_job++; i < this->job_count; i = this->next_job++) {
+				(*this->job)(i);
+			}
+		}
+	}
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tec {
+	namespace networking {
+		// Threads, besides the simulation thread, that build client snapshots. 0 uses one per
+		// core other than the simulation thread's.
+		extern std::size_t SNAPSHOT_WORKER_THREADS;
+
+		// A fixed set of threads that split a batch of independent jobs between them, for work
+		// that has to be done every tick. The threads are kept between batches so starting one
+		// costs a wakeup rather than a thread.
+		class WorkerPool {
+		public:
+			// thread_count of 0 uses one per core other than the caller's.
+			explicit WorkerPool(std::size_t thread_count = SNAPSHOT_WORKER_THREADS);
+			~WorkerPool();
+
+			WorkerPool(const WorkerPool&) = delete;
+			WorkerPool& operator=(const WorkerPool&) = delete;
+
+			// Calls job(i) for every i below count, spread over the pool and the calling thread, and
+			// returns once they have all returned. Jobs are handed out one at a time so a slow one
+			// doesn't hold up the rest. job must not throw. Only one Run at a time.
+			void Run(std::size_t count, const std::function<void(std::size_t)>& job);
+
+			std::size_t GetThreadCount() const {
+				return this->threads.size();
+			}
+		private:
+			void WorkerLoop();
+
+			// Claims and runs jobs from the current batch until there are none left.
+			void Work();
+
+			std::vector<std::thread> threads;
+			std::mutex mutex; // Guards everything below but next_job.
+			std::condition_variable batch_started, batch_finished;
+			const std::function<void(std::size_t)>* job{ nullptr };
+			std::size_t job_count{ 0 };
+			std::atomic<std::size_t> next_job{ 0 };
+			std::size_t busy_workers{ 0 };
+			std::uint64_t batch{ 0 }; // Bumped for every Run so workers can tell a new batch has started.
+			bool stopping{ false };
+		};
+	}
+}
@@ -7,6 +7,11 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+
 #include <asio.hpp>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/stdout_sinks.h>
@@ -18,10 +23,16 @@ namespace tec {
 	eid active_entity; // used in physics-system so when accessor is made remove
 }
 
+static void RegisterTestLogger() {
+	if (!spdlog::get("console_log")) {
+		std::vector<spdlog::sink_ptr> sinks;
+		auto log = std::make_shared<spdlog::logger>("console_log", begin(sinks), end(sinks));
+		spdlog::register_logger(log);
+	}
+}
+
 TEST(ClientServerConnection_test, Constructor) {
-	std::vector<spdlog::sink_ptr> sinks;
-	auto log = std::make_shared<spdlog::logger>("console_log", begin(sinks), end(sinks));
-	spdlog::register_logger(log);
+	RegisterTestLogger();
 
 	tcp::endpoint endpoint(asio::ip::tcp::v4(), tec::networking::SERVER_PORT);
 	tec::networking::Server server(endpoint);
@@ -55,3 +66,55 @@ TEST(ClientServerConnection_test, Constructor) {
 
 }
 
+// Measures how many messages per second one connection can push through the server's
+// receive path. The server echoes SYNC messages straight back, so this times the full round trip.
+TEST(ClientServerConnection_test, SyncThroughput) {
+	RegisterTestLogger();
+
+	tcp::endpoint endpoint(asio::ip::tcp::v4(), tec::networking::SERVER_PORT);
+	tec::networking::Server server(endpoint);
+	std::thread start_thread([&server] () {server.Start(); });
+
+	const int message_count = 10000;
+	std::atomic<int> received{ 0 };
+	std::promise<void> promise_all_received;
+	std::future<void> all_received = promise_all_received.get_future();
+
+	tec::networking::ServerConnection connection;
+	std::shared_ptr<std::thread> asio_thread;
+
+	connection.RegisterMessageHandler(
+		tec::networking::MessageType::SYNC,
+		[&] (const tec::networking::ServerMessage&) {
+			if (++received == message_count) {
+				promise_all_received.set_value();
+			}
+		});
+	connection.RegisterConnectFunc(
+		[&] () {
+			asio_thread = std::make_shared < std::thread >(std::thread(([&connection] () { connection.StartRead(); })));
+		});
+	ASSERT_TRUE(connection.Connect());
+
+	tec::networking::ServerMessage sync_msg;
+	sync_msg.SetBodyLength(1);
+	sync_msg.SetMessageType(tec::networking::MessageType::SYNC);
+	sync_msg.encode_header();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < message_count; ++i) {
+		connection.Send(sync_msg);
+	}
+	auto status = all_received.wait_for(std::chrono::seconds(10));
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	server.Stop();
+	start_thread.join();
+	connection.Stop();
+	asio_thread->join();
+
+	EXPECT_EQ(status, std::future_status::ready);
+	EXPECT_EQ(received, message_count);
+	std::cout << "[ THROUGHPUT ] " << static_cast<int>(received / elapsed.count())
+		<< " messages per second on one connection" << std::endl;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - resending unacked client commands
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include "command-history.hpp"
+
+using tec::CommandHistory;
+using tec::proto::ClientCommands;
+
+namespace {
+	ClientCommands MakeCommand(std::uint64_t command_id) {
+		ClientCommands command;
+		command.set_id(1);
+		command.set_commandid(command_id);
+		command.set_tick(100 + command_id + command_id / 3); // Skips a tick now and then.
+		tec::proto::MovementCommand* movement = command.mutable_movement();
+		movement->set_forward(command_id % 4 < 2);
+		movement->set_backward(false);
+		movement->set_leftstrafe(command_id % 5 == 0);
+		movement->set_rightstrafe(false);
+		tec::proto::OrientationCommand* orientation = command.mutable_orientation();
+		orientation->set_x(0.0f);
+		orientation->set_y(command_id % 3 == 0 ? 0.5f : 0.0f);
+		orientation->set_z(0.0f);
+		orientation->set_w(1.0f);
+		if (command_id == 7) {
+			command.add_commandlist("jump");
+		}
+		return command;
+	}
+}
+
+TEST(CommandHistory_test, ResendsUnackedCommands) {
+	CommandHistory history;
+	std::vector<ClientCommands> sent;
+	for (std::uint64_t id = 1; id <= 12; ++id) {
+		sent.push_back(MakeCommand(id));
+		if (id == 10) {
+			history.Ack(8);
+		}
+		ClientCommands message = sent.back();
+		history.AddPreviousCommands(message);
+
+		std::vector<ClientCommands> received;
+		tec::ExpandClientCommands(message, received);
+		// Everything unacked, up to the limit.
+		const std::uint64_t acked = id >= 10 ? 8 : 0;
+		const std::size_t expected = std::min<std::size_t>(id - acked, tec::REDUNDANT_COMMAND_COUNT + 1);
+		ASSERT_EQ(received.size(), expected);
+		for (std::size_t i = 0; i < received.size(); ++i) {
+			const ClientCommands& original = sent[id - expected + i];
+			received[i].clear_previous();
+			EXPECT_TRUE(google::protobuf::util::MessageDifferencer::Equals(received[i], original))
+				<< "command " << original.commandid() << " in message " << id;
+		}
+	}
+}
+
+TEST(CommandHistory_test, UnchangedFieldsAreOmitted) {
+	CommandHistory history;
+	ClientCommands first = MakeCommand(1);
+	first.mutable_movement()->set_forward(true);
+	first.mutable_orientation()->set_y(0.0f);
+	history.AddPreviousCommands(first);
+	ClientCommands second = first;
+	second.set_commandid(2);
+	second.set_tick(first.tick() + 1);
+	ClientCommands alone = second;
+	history.AddPreviousCommands(second);
+
+	// An identical previous command costs only its (empty) entry.
+	ASSERT_EQ(second.previous_size(), 1);
+	EXPECT_EQ(second.ByteSize(), alone.ByteSize() + 2);
+}
@@ -0,0 +1,151 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - the updates the server builds for each client
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include <asio.hpp>
+#include <game_state.pb.h>
+
+#include "server.hpp"
+#include "client-connection.hpp"
+#include "interest-manager.hpp"
+#include "events.hpp"
+#include "scratch-arena.hpp"
+#include "snapshot-delta.hpp"
+
+using tec::eid;
+using tec::state_id_t;
+using tec::GameState;
+using tec::Position;
+using tec::networking::ClientConnection;
+using tec::networking::InterestManager;
+using tec::networking::Server;
+using tec::networking::ServerMessage;
+
+namespace {
+	// Never destroyed, as event queues don't unsubscribe when they are.
+	Server& GetTestServer() {
+		static Server* server = [] () {
+			tcp::endpoint endpoint(asio::ip::address_v4::loopback(), 0);
+			return new Server(endpoint, 1);
+		}();
+		return *server;
+	}
+
+	// Puts entity_id in state at position, and gives the server an ENTITY_CREATE to stream for it.
+	void AddEntity(eid entity_id, const glm::vec3& position, GameState& state) {
+		std::shared_ptr<tec::EntityCreated> data = std::make_shared<tec::EntityCreated>();
+		data->entity_id = entity_id;
+		data->entity.set_id(entity_id);
+		GetTestServer().On(data);
+		state.positions[entity_id] = Position(position);
+	}
+
+	// A connection that is never opened, with the client's side of it played here: every update
+	// is applied to the one before and acked straight away.
+	struct TestClient {
+		TestClient(asio::io_context& io_context, eid id) :
+			connection(std::make_shared<ClientConnection>(tcp::socket(io_context), &GetTestServer())) {
+			this->connection->SetID(id);
+			this->connection->SetStreamBudget(1 << 20); // Everything in range is known straight away.
+		}
+
+		// Runs one server tick against full_state and applies the update it builds.
+		::testing::AssertionResult Tick(const GameState& full_state) {
+			InterestManager interest;
+			interest.Update(full_state);
+			this->connection->UpdateGameState(full_state, interest);
+			tec::EncodedState encoded;
+			tec::EncodeState(full_state, encoded);
+			tec::ScratchArena arena;
+			const state_id_t state_id = ++this->last_state_id;
+			if (!this->connection->PrepareGameStateUpdateMessage(state_id, encoded, arena, this->update)) {
+				return ::testing::AssertionFailure() << "update " << state_id << " wasn't built";
+			}
+			if (!this->gsu.ParseFromArray(this->update.GetBodyPTR(), static_cast<int>(this->update.GetBodyLength()))) {
+				return ::testing::AssertionFailure() << "update " << state_id << " doesn't parse";
+			}
+			GameState next;
+			if (!tec::ApplyStateDelta(this->state, this->gsu, next)) {
+				return ::testing::AssertionFailure() << "update " << state_id << " doesn't apply";
+			}
+			this->state = std::move(next);
+			this->connection->ConfirmStateID(state_id);
+			return ::testing::AssertionSuccess();
+		}
+
+		std::shared_ptr<ClientConnection> connection;
+		state_id_t last_state_id{ 0 };
+		ServerMessage update; // The last update built.
+		tec::proto::GameStateUpdate gsu; // update, parsed.
+		GameState state; // What the client has once it applied update.
+	};
+}
+
+TEST(GameStateUpdate_test, ManyRemovalsAreSpreadOverUpdates) {
+	const eid client_id = 1;
+	const eid first_id = 1000;
+	const std::size_t entity_count = 200;
+	asio::io_context io_context;
+	GameState full_state;
+	full_state.positions[client_id] = Position(glm::vec3(0.0f));
+	for (std::size_t i = 0; i < entity_count; ++i) {
+		AddEntity(first_id + i, glm::vec3(2.0f * (i % 20), 0.0f, 2.0f * (i / 20)), full_state);
+	}
+
+	TestClient client(io_context, client_id);
+	for (int tick = 0; tick < 100 && client.state.positions.size() < entity_count; ++tick) {
+		ASSERT_TRUE(client.Tick(full_state));
+	}
+	ASSERT_EQ(client.state.positions.size(), entity_count);
+
+	// All of them leave the area of interest at once. Removing them in one update wouldn't fit
+	// in a message.
+	for (std::size_t i = 0; i < entity_count; ++i) {
+		full_state.positions[first_id + i] = Position(glm::vec3(1000.0f + i, 0.0f, 0.0f));
+	}
+	for (int tick = 0; tick < 100 && !client.state.positions.empty(); ++tick) {
+		ASSERT_TRUE(client.Tick(full_state));
+		EXPECT_LE(static_cast<std::size_t>(client.gsu.removed_entity_size()),
+			tec::networking::MAX_REMOVED_ENTITIES_PER_UPDATE);
+		EXPECT_LE(client.update.GetBodyLength(), static_cast<std::size_t>(ServerMessage::max_body_length));
+	}
+	EXPECT_TRUE(client.state.positions.empty());
+}
+
+TEST(GameStateUpdate_test, StaleEntitiesWinOverNearbyOnes) {
+	const eid client_id = 2;
+	const eid far_id = 2000, first_near_id = 2001;
+	const std::size_t near_count = 60, budget = 200;
+	asio::io_context io_context;
+	GameState full_state;
+	full_state.positions[client_id] = Position(glm::vec3(0.0f));
+	AddEntity(far_id, glm::vec3(120.0f, 0.0f, 0.0f), full_state); // In the outer band.
+	for (std::size_t i = 0; i < near_count; ++i) {
+		AddEntity(first_near_id + i, glm::vec3(1.5f * (i % 8), 0.0f, 1.5f * (i / 8)), full_state);
+	}
+
+	TestClient client(io_context, client_id);
+	client.connection->SetSnapshotBudget(budget);
+	int far_tick = -1;
+	for (int tick = 0; tick < 100; ++tick) {
+		// The nearby entities never stop moving, so they always have something to send.
+		for (std::size_t i = 0; i < near_count; ++i) {
+			full_state.positions[first_near_id + i].value.x += 0.1f;
+		}
+		ASSERT_TRUE(client.Tick(full_state));
+		EXPECT_LE(client.update.GetBodyLength(), budget);
+		if (far_tick < 0 && client.state.positions.count(far_id)) {
+			far_tick = tick;
+		}
+	}
+	// Not everything fits at once, and the far entity starts out losing to the nearby ones.
+	EXPECT_GT(far_tick, 0);
+	EXPECT_LT(far_tick, 50);
+}
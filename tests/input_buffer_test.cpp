@@ -0,0 +1,69 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - the server's per client input buffer
+ */
+
+#include <gtest/gtest.h>
+
+#include "input-buffer.hpp"
+
+using tec::ClientCommandsEvent;
+using tec::networking::InputBuffer;
+
+namespace {
+	ClientCommandsEvent MakeCommand(std::uint64_t command_id) {
+		ClientCommandsEvent command;
+		command.client_commands.set_id(1);
+		command.client_commands.set_commandid(command_id);
+		return command;
+	}
+}
+
+TEST(InputBuffer_test, OneCommandPerTickInOrder) {
+	InputBuffer buffer(2);
+	ClientCommandsEvent command;
+	EXPECT_FALSE(buffer.Pop(command)); // Nothing has arrived yet.
+
+	// A burst arriving out of order is still handed out one at a time, in order.
+	for (std::uint64_t id : { 3, 1, 2, 4 }) {
+		EXPECT_TRUE(buffer.Push(MakeCommand(id)));
+	}
+	for (std::uint64_t id = 1; id <= 4; ++id) {
+		ASSERT_TRUE(buffer.Pop(command));
+		EXPECT_EQ(command.client_commands.commandid(), id);
+	}
+	EXPECT_EQ(buffer.GetStats().underruns, 0u);
+	EXPECT_EQ(buffer.GetStats().overruns, 0u);
+}
+
+TEST(InputBuffer_test, RepeatsLastCommandWhenStarved) {
+	InputBuffer buffer(1);
+	ClientCommandsEvent command;
+	buffer.Push(MakeCommand(1));
+	ASSERT_TRUE(buffer.Pop(command));
+	ASSERT_TRUE(buffer.Pop(command));
+	EXPECT_EQ(command.client_commands.commandid(), 1u);
+	EXPECT_EQ(buffer.GetStats().underruns, 1u);
+
+	// Duplicates and commands older than the last one applied are dropped.
+	EXPECT_FALSE(buffer.Push(MakeCommand(1)));
+	EXPECT_TRUE(buffer.Push(MakeCommand(2)));
+	EXPECT_FALSE(buffer.Push(MakeCommand(2)));
+	EXPECT_EQ(buffer.GetStats().late, 2u);
+	ASSERT_TRUE(buffer.Pop(command));
+	EXPECT_EQ(command.client_commands.commandid(), 2u);
+}
+
+TEST(InputBuffer_test, SkipsAheadWhenOverfull) {
+	InputBuffer buffer(2);
+	ClientCommandsEvent command;
+	for (std::uint64_t id = 1; id <= 10; ++id) {
+		buffer.Push(MakeCommand(id));
+	}
+	ASSERT_TRUE(buffer.Pop(command));
+	EXPECT_EQ(command.client_commands.commandid(), 9u);
+	EXPECT_EQ(buffer.GetStats().overruns, 8u);
+	EXPECT_EQ(buffer.GetStats().depth, 1u);
+}
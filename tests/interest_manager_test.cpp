@@ -0,0 +1,103 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - the server's interest grid
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "interest-manager.hpp"
+
+using tec::eid;
+using tec::GameState;
+using tec::Position;
+using tec::networking::InterestManager;
+using tec::networking::InterestRule;
+
+namespace {
+	std::vector<eid> QuerySorted(const InterestManager& interest, const glm::vec3& center, float radius) {
+		std::vector<eid> found;
+		interest.Query(center, radius, found);
+		std::sort(found.begin(), found.end());
+		return found;
+	}
+}
+
+TEST(InterestManager_test, QueryAcrossCellBoundaries) {
+	InterestManager interest(10.0f);
+	GameState state;
+	state.positions[1] = Position(glm::vec3(9.5f, 0.0f, 0.0f));
+	state.positions[2] = Position(glm::vec3(10.5f, 0.0f, 0.0f)); // The next cell along.
+	state.positions[3] = Position(glm::vec3(-0.5f, 0.0f, 0.0f)); // A negative cell.
+	state.positions[4] = Position(glm::vec3(10.0f, 10.5f, -0.5f)); // Diagonally across.
+	interest.Update(state);
+
+	EXPECT_EQ(QuerySorted(interest, glm::vec3(10.0f, 0.0f, 0.0f), 1.0f), std::vector<eid>({ 1, 2 }));
+	EXPECT_EQ(QuerySorted(interest, glm::vec3(0.0f, 0.0f, 0.0f), 1.0f), std::vector<eid>({ 3 }));
+	EXPECT_EQ(QuerySorted(interest, glm::vec3(10.0f, 10.0f, 0.0f), 1.0f), std::vector<eid>({ 4 }));
+	// A radius wider than a cell reaches several cells in every direction.
+	EXPECT_EQ(QuerySorted(interest, glm::vec3(5.0f, 5.0f, 0.0f), 25.0f), std::vector<eid>({ 1, 2, 3, 4 }));
+}
+
+TEST(InterestManager_test, RadiusEdges) {
+	InterestManager interest(10.0f);
+	GameState state;
+	state.positions[1] = Position(glm::vec3(15.0f, 0.0f, 0.0f)); // Exactly on the radius.
+	state.positions[2] = Position(glm::vec3(15.01f, 0.0f, 0.0f)); // Just past it.
+	state.positions[3] = Position(glm::vec3(10.0f, 0.0f, -5.0f));
+	interest.Update(state);
+
+	EXPECT_EQ(QuerySorted(interest, glm::vec3(10.0f, 0.0f, 0.0f), 5.0f), std::vector<eid>({ 1, 3 }));
+	EXPECT_TRUE(QuerySorted(interest, glm::vec3(10.0f, 0.0f, 0.0f), 0.0f).empty());
+}
+
+TEST(InterestManager_test, MatchesBruteForce) {
+	InterestManager interest(8.0f);
+	GameState state;
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+	for (eid id = 1; id <= 500; ++id) {
+		state.positions[id] = Position(glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng)));
+	}
+	interest.Update(state);
+
+	for (int i = 0; i < 50; ++i) {
+		const glm::vec3 center(coordinate(rng), coordinate(rng), coordinate(rng));
+		const float radius = std::uniform_real_distribution<float>(0.0f, 60.0f)(rng);
+		std::vector<eid> expected;
+		for (const auto& position : state.positions) {
+			const glm::vec3 offset = position.second.value - center;
+			if (glm::dot(offset, offset) <= radius * radius) {
+				expected.push_back(position.first);
+			}
+		}
+		std::sort(expected.begin(), expected.end());
+		EXPECT_EQ(QuerySorted(interest, center, radius), expected);
+	}
+}
+
+TEST(InterestManager_test, UpdateReplacesLastTick) {
+	InterestManager interest(10.0f);
+	GameState state;
+	state.positions[1] = Position(glm::vec3(0.0f, 0.0f, 0.0f));
+	interest.Update(state);
+	state.positions[1] = Position(glm::vec3(50.0f, 0.0f, 0.0f));
+	interest.Update(state);
+
+	EXPECT_TRUE(QuerySorted(interest, glm::vec3(0.0f, 0.0f, 0.0f), 5.0f).empty());
+	EXPECT_EQ(QuerySorted(interest, glm::vec3(50.0f, 0.0f, 0.0f), 5.0f), std::vector<eid>({ 1 }));
+}
+
+TEST(InterestManager_test, RulePriorities) {
+	const std::vector<InterestRule> rules = { { 50.0f, 1.0f }, { 150.0f, 0.25f } };
+	EXPECT_EQ(InterestManager::GetPriority(rules, 0.0f), 1.0f);
+	EXPECT_EQ(InterestManager::GetPriority(rules, 50.0f), 1.0f);
+	EXPECT_EQ(InterestManager::GetPriority(rules, 50.5f), 0.25f);
+	EXPECT_EQ(InterestManager::GetPriority(rules, 150.5f), 0.0f);
+	EXPECT_EQ(InterestManager::GetMaxRadius(rules), 150.0f);
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - rewinding the collision world for hit queries
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "lag-compensation.hpp"
+#include "physics-system.hpp"
+#include "events.hpp"
+
+using tec::eid;
+using tec::GameState;
+using tec::Position;
+using tec::PhysicsSystem;
+using tec::networking::LagCompensator;
+
+namespace {
+	// Never destroyed, as event queues don't unsubscribe when they are.
+	PhysicsSystem& GetTestPhysics() {
+		static PhysicsSystem* physics = new PhysicsSystem();
+		return *physics;
+	}
+
+	// Gives entity_id a static sphere body.
+	void AddSphere(eid entity_id, float radius) {
+		std::shared_ptr<tec::EntityCreated> data = std::make_shared<tec::EntityCreated>();
+		data->entity_id = entity_id;
+		data->entity.set_id(entity_id);
+		tec::proto::CollisionBody* body = data->entity.add_components()->mutable_collision_body();
+		body->mutable_sphere()->set_radius(radius);
+		body->set_mass(0.0f);
+		GetTestPhysics().On(data);
+	}
+}
+
+TEST(LagCompensation_test, RayCastSeesRecordedPositions) {
+	PhysicsSystem& physics = GetTestPhysics();
+	LagCompensator lag_compensator(physics);
+	const eid target = 501;
+	// Bigger than any fixed margin would allow for, so queries must use the shape's size.
+	AddSphere(target, 6.0f);
+
+	GameState state;
+	state.state_id = 1;
+	state.positions[target] = Position(glm::vec3(0.0f, 0.0f, 0.0f));
+	physics.Update(1.0 / 60.0, state);
+	lag_compensator.Record(state);
+	state.state_id = 2;
+	state.positions[target] = Position(glm::vec3(40.0f, 0.0f, 0.0f));
+	physics.Update(1.0 / 60.0, state);
+	lag_compensator.Record(state);
+
+	// Short rays down onto the sphere's top, their middles too far from its origin for a fixed margin.
+	const glm::vec3 from(0.0f, 9.5f, 0.0f), to(0.0f, 5.5f, 0.0f), moved(40.0f, 0.0f, 0.0f);
+	EXPECT_EQ(physics.RayCast(from, to, 0), 0u);
+	glm::vec3 hit_point;
+	EXPECT_EQ(lag_compensator.RayCast(1, 0, from, to, &hit_point), target);
+	EXPECT_NEAR(hit_point.y, 6.0f, 0.01f);
+	// Where it is now it hadn't got to yet.
+	EXPECT_EQ(lag_compensator.RayCast(1, 0, from + moved, to + moved), 0u);
+	EXPECT_EQ(lag_compensator.RayCast(2, 0, from + moved, to + moved), target);
+	// Never rewound for its own queries.
+	EXPECT_EQ(lag_compensator.RayCast(1, target, from, to), 0u);
+
+	// Every query puts it back.
+	glm::vec3 position;
+	glm::quat orientation;
+	ASSERT_TRUE(physics.GetBodyTransform(target, position, orientation));
+	EXPECT_EQ(position, moved);
+	EXPECT_EQ(physics.RayCast(from + moved, to + moved, 0), target);
+}
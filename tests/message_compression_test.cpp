@@ -0,0 +1,94 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - per message compression
+ */
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <string>
+
+#include "message-compression.hpp"
+
+using tec::networking::MessageCompressor;
+using tec::networking::MessageDecompressor;
+using tec::networking::ServerMessage;
+using tec::networking::MessageType;
+
+namespace {
+	ServerMessage MakeMessage(const std::string& body) {
+		ServerMessage msg;
+		msg.SetMessageType(MessageType::ENTITY_CREATE);
+		msg.SetStateID(42);
+		msg.SetBodyLength(body.size());
+		std::memcpy(msg.GetBodyPTR(), body.c_str(), msg.GetBodyLength());
+		msg.encode_header();
+		return msg;
+	}
+
+	// Roughly what an entity's components look like on the wire: names and asset paths that
+	// repeat from one entity to the next.
+	std::string MakeEntityBody(int entity) {
+		std::string body;
+		for (int i = 0; i < 6; ++i) {
+			body += "renderable:meshes/cube.obj;shader:shaders/basic;";
+			body += "position:" + std::to_string(entity * 7 + i) + ";";
+		}
+		return body;
+	}
+}
+
+TEST(MessageCompression_test, RoundTrip) {
+	MessageCompressor compressor;
+	MessageDecompressor decompressor;
+	std::size_t original_bytes = 0, compressed_bytes = 0;
+	// The same contexts are reused for every message, each of which must decode on its own.
+	for (int entity = 0; entity < 100; ++entity) {
+		const std::string body = MakeEntityBody(entity);
+		ServerMessage msg = MakeMessage(body);
+		ASSERT_TRUE(compressor.Compress(msg));
+		EXPECT_LT(msg.GetBodyLength(), body.size());
+		original_bytes += body.size();
+		compressed_bytes += msg.GetBodyLength();
+
+		// As the other end would read it.
+		ServerMessage received;
+		std::memcpy(received.GetDataPTR(), msg.GetDataPTR(), msg.length());
+		ASSERT_TRUE(received.decode_header());
+		EXPECT_TRUE(received.IsCompressed());
+		EXPECT_EQ(received.GetMessageType(), MessageType::ENTITY_CREATE);
+		EXPECT_EQ(received.GetStateID(), 42);
+		ASSERT_TRUE(decompressor.Decompress(received));
+		EXPECT_FALSE(received.IsCompressed());
+		EXPECT_EQ(std::string(received.GetBodyPTR(), received.GetBodyLength()), body);
+	}
+	std::cout << "[ COMPRESSION ] " << original_bytes << " bytes to " << compressed_bytes << std::endl;
+}
+
+TEST(MessageCompression_test, SmallAndIncompressibleBodiesAreLeftAlone) {
+	MessageCompressor compressor;
+	ServerMessage small = MakeMessage("chat");
+	EXPECT_FALSE(compressor.Compress(small));
+	EXPECT_FALSE(small.IsCompressed());
+
+	std::string noise;
+	std::uint32_t seed = 1;
+	for (int i = 0; i < 300; ++i) {
+		seed = seed * 1664525 + 1013904223;
+		noise.push_back(static_cast<char>(seed >> 24));
+	}
+	ServerMessage random = MakeMessage(noise);
+	EXPECT_FALSE(compressor.Compress(random));
+	EXPECT_EQ(std::string(random.GetBodyPTR(), random.GetBodyLength()), noise);
+}
+
+TEST(MessageCompression_test, CorruptBodiesAreRejected) {
+	MessageCompressor compressor;
+	MessageDecompressor decompressor;
+	ServerMessage msg = MakeMessage(MakeEntityBody(1));
+	ASSERT_TRUE(compressor.Compress(msg));
+	msg.SetBodyLength(msg.GetBodyLength() / 2);
+	EXPECT_FALSE(decompressor.Decompress(msg));
+}
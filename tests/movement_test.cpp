@@ -0,0 +1,91 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - the shared movement step
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "controllers/movement.hpp"
+
+using tec::MovementState;
+using tec::StepMovement;
+
+namespace {
+	tec::proto::ClientCommands MakeCommand(bool forward, bool left_strafe, float yaw) {
+		tec::proto::ClientCommands command;
+		command.set_id(1);
+		command.set_commandid(0);
+		tec::proto::MovementCommand* movement = command.mutable_movement();
+		movement->set_forward(forward);
+		movement->set_backward(false);
+		movement->set_leftstrafe(left_strafe);
+		movement->set_rightstrafe(false);
+		glm::quat orientation = glm::angleAxis(yaw, glm::vec3(0.0f, 1.0f, 0.0f));
+		tec::proto::OrientationCommand* orientation_command = command.mutable_orientation();
+		orientation_command->set_x(orientation.x);
+		orientation_command->set_y(orientation.y);
+		orientation_command->set_z(orientation.z);
+		orientation_command->set_w(orientation.w);
+		return command;
+	}
+}
+
+TEST(Movement_test, FollowsRecordedTrajectory) {
+	// Each command is stepped as the server would, from a received copy, and checked against
+	// velocities worked out by hand. At 60 steps per second velocity changes by at most 1 a step.
+	const float dt = 1.0f / 60.0f;
+	const float quarter_turn = 1.57079633f;
+	struct Step {
+		bool forward, left_strafe;
+		float yaw;
+		glm::vec3 velocity;
+	};
+	const std::vector<Step> steps = {
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -1.0f) },
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -2.0f) },
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -3.0f) },
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -4.0f) },
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -5.0f) },
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -6.0f) },
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -7.0f) },
+		{ true, false, 0.0f, glm::vec3(0.0f, 0.0f, -7.5f) }, // Top speed.
+		{ true, true, 0.0f, glm::vec3(-1.0f, 0.0f, -7.5f) },
+		// Turned to face -x, so forward is now (-7.5, 0, 0).
+		{ true, false, quarter_turn, glm::vec3(-1.65493054f, 0.0f, -6.74431092f) },
+		{ false, false, quarter_turn, glm::vec3(-1.41661860f, 0.0f, -5.77312225f) },
+	};
+	MovementState state;
+	for (std::size_t i = 0; i < steps.size(); ++i) {
+		tec::proto::ClientCommands received;
+		ASSERT_TRUE(received.ParseFromString(MakeCommand(steps[i].forward, steps[i].left_strafe, steps[i].yaw).SerializeAsString()));
+		state = StepMovement(state, received, dt);
+		EXPECT_NEAR(state.velocity.x, steps[i].velocity.x, 1e-4f) << "step " << i;
+		EXPECT_NEAR(state.velocity.y, steps[i].velocity.y, 1e-4f) << "step " << i;
+		EXPECT_NEAR(state.velocity.z, steps[i].velocity.z, 1e-4f) << "step " << i;
+	}
+	// The last command's orientation, a quarter turn about y.
+	EXPECT_NEAR(state.orientation.w, 0.70710678f, 1e-5f);
+	EXPECT_NEAR(state.orientation.x, 0.0f, 1e-5f);
+	EXPECT_NEAR(state.orientation.y, 0.70710678f, 1e-5f);
+	EXPECT_NEAR(state.orientation.z, 0.0f, 1e-5f);
+}
+
+TEST(Movement_test, AccelerationIsLimitedPerStep) {
+	const float dt = 1.0f / 60.0f;
+	MovementState state = StepMovement(MovementState(), MakeCommand(true, false, 0.0f), dt);
+	EXPECT_NEAR(glm::length(state.velocity), tec::MOVEMENT_ACCELERATION * dt, 1e-4f);
+	for (int i = 0; i < 60; ++i) {
+		state = StepMovement(state, MakeCommand(true, false, 0.0f), dt);
+	}
+	EXPECT_NEAR(state.velocity.z, -tec::MOVEMENT_FORWARD_SPEED, 1e-4f);
+
+	// Letting go stops it again.
+	for (int i = 0; i < 60; ++i) {
+		state = StepMovement(state, MakeCommand(false, false, 0.0f), dt);
+	}
+	EXPECT_EQ(glm::length(state.velocity), 0.0f);
+}
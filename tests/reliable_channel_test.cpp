@@ -0,0 +1,161 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - ReliableChannel over a lossy loopback proxy
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+#include <asio.hpp>
+
+#include "reliable-channel.hpp"
+
+using asio::ip::udp;
+using tec::networking::ReliableChannel;
+using tec::networking::ServerMessage;
+using tec::networking::MessageType;
+
+namespace {
+	// Sits between two sockets on loopback and drops a fixed fraction of the datagrams it relays.
+	class LossyProxy {
+	public:
+		LossyProxy(asio::io_service& io_service, double loss_rate) :
+			socket(io_service, udp::endpoint(asio::ip::address_v4::loopback(), 0)),
+			drop(loss_rate) { }
+
+		udp::endpoint GetEndpoint() const {
+			return this->socket.local_endpoint();
+		}
+
+		// Receives the datagram just sent to the proxy and forwards it to target unless
+		// it is dropped. Returns true if it was forwarded.
+		bool Relay(udp::socket& target) {
+			char datagram[ReliableChannel::max_packet_size];
+			udp::endpoint sender;
+			std::size_t length = this->socket.receive_from(asio::buffer(datagram), sender);
+			if (this->drop(this->rng)) {
+				return false;
+			}
+			this->socket.send_to(asio::buffer(datagram, length), target.local_endpoint());
+			return true;
+		}
+
+	private:
+		udp::socket socket;
+		std::mt19937 rng{ 42 }; // Fixed seed so the test is repeatable.
+		std::bernoulli_distribution drop;
+	};
+
+	ServerMessage MakeMessage(MessageType type, const std::string& body, tec::state_id_t state_id = 0) {
+		ServerMessage msg;
+		msg.SetMessageType(type);
+		msg.SetStateID(state_id);
+		msg.SetBodyLength(body.size());
+		std::memcpy(msg.GetBodyPTR(), body.c_str(), msg.GetBodyLength());
+		msg.encode_header();
+		return msg;
+	}
+}
+
+TEST(ReliableChannel_test, LossyLoopback) {
+	asio::io_service io_service;
+	udp::socket client_socket(io_service, udp::endpoint(asio::ip::address_v4::loopback(), 0));
+	udp::socket server_socket(io_service, udp::endpoint(asio::ip::address_v4::loopback(), 0));
+	LossyProxy proxy(io_service, 0.3);
+
+	const std::uint32_t connection_id = 1234;
+	ReliableChannel server(connection_id), client(connection_id);
+	// Channels never read the clock themselves so time is simulated to keep the test fast.
+	ReliableChannel::clock::time_point now;
+
+	const int chat_count = 200;
+	int chats_queued = 0, chats_received = 0, updates_received = 0;
+	tec::state_id_t last_update_state_id = -1;
+	bool in_order = true, duplicate_or_stale = false;
+
+	char datagram[ReliableChannel::max_packet_size];
+	for (int tick = 0; tick < 2000 && chats_received < chat_count; ++tick) {
+		now += std::chrono::milliseconds(50);
+		for (int i = 0; i < 2 && chats_queued < chat_count; ++i, ++chats_queued) {
+			server.Queue(MakeMessage(MessageType::CHAT_MESSAGE, std::to_string(chats_queued)));
+		}
+		server.Queue(MakeMessage(MessageType::GAME_STATE_UPDATE, "state", tick));
+
+		std::size_t length = server.WritePacket(datagram, sizeof(datagram), now);
+		server_socket.send_to(asio::buffer(datagram, length), proxy.GetEndpoint());
+		if (proxy.Relay(client_socket)) {
+			length = client_socket.receive(asio::buffer(datagram));
+			ASSERT_TRUE(client.ReadPacket(datagram, length, [&] (ServerMessage& msg) {
+				if (msg.GetMessageType() == MessageType::CHAT_MESSAGE) {
+					std::string body(msg.GetBodyPTR(), msg.GetBodyLength());
+					in_order = in_order && (std::stoi(body) == chats_received);
+					++chats_received;
+				}
+				else {
+					duplicate_or_stale = duplicate_or_stale || (msg.GetStateID() <= last_update_state_id);
+					last_update_state_id = msg.GetStateID();
+					++updates_received;
+				}
+			}));
+		}
+
+		// The client only sends acks back.
+		length = client.WritePacket(datagram, sizeof(datagram), now);
+		client_socket.send_to(asio::buffer(datagram, length), proxy.GetEndpoint());
+		if (proxy.Relay(server_socket)) {
+			length = server_socket.receive(asio::buffer(datagram));
+			ASSERT_TRUE(server.ReadPacket(datagram, length, [] (ServerMessage&) { }));
+		}
+	}
+
+	EXPECT_EQ(chats_received, chat_count);
+	EXPECT_TRUE(in_order);
+	EXPECT_FALSE(duplicate_or_stale);
+	EXPECT_GT(updates_received, 0);
+}
+
+TEST(ReliableChannel_test, RejectsOtherConnections) {
+	ReliableChannel sender(1), receiver(2);
+	sender.Queue(MakeMessage(MessageType::CHAT_MESSAGE, "hello"));
+	char datagram[ReliableChannel::max_packet_size];
+	std::size_t length = sender.WritePacket(datagram, sizeof(datagram));
+	int delivered = 0;
+	EXPECT_FALSE(receiver.ReadPacket(datagram, length, [&delivered] (ServerMessage&) { ++delivered; }));
+	EXPECT_FALSE(receiver.ReadPacket(datagram, ReliableChannel::header_length - 1, [&delivered] (ServerMessage&) { ++delivered; }));
+	EXPECT_EQ(delivered, 0);
+}
+
+TEST(ReliableChannel_test, StallsWhenNothingIsAcked) {
+	// Every datagram to the peer is dropped, so nothing is ever acked.
+	ReliableChannel sender(1), receiver(1);
+	ReliableChannel::clock::time_point now;
+	char datagram[ReliableChannel::max_packet_size];
+	ASSERT_TRUE(sender.Queue(MakeMessage(MessageType::CHAT_MESSAGE, "0")));
+	sender.WritePacket(datagram, sizeof(datagram), now);
+	for (now += ReliableChannel::resend_interval; now < ReliableChannel::clock::time_point() + ReliableChannel::ack_timeout;
+		now += ReliableChannel::resend_interval) {
+		EXPECT_FALSE(sender.IsStalled(now));
+		sender.WritePacket(datagram, sizeof(datagram), now); // Resends never reset the timeout.
+	}
+	EXPECT_TRUE(sender.IsStalled(now));
+
+	// Once the peer gets through and acks, the channel recovers.
+	std::size_t length = sender.WritePacket(datagram, sizeof(datagram), now);
+	ASSERT_TRUE(receiver.ReadPacket(datagram, length, [] (ServerMessage&) { }));
+	length = receiver.WritePacket(datagram, sizeof(datagram), now);
+	ASSERT_TRUE(sender.ReadPacket(datagram, length, [] (ServerMessage&) { }));
+	EXPECT_FALSE(sender.IsStalled(now));
+
+	// The queue is capped, well short of where reliable ids would wrap.
+	for (int i = 0; i < ReliableChannel::max_pending_reliable; ++i) {
+		ASSERT_TRUE(sender.Queue(MakeMessage(MessageType::CHAT_MESSAGE, std::to_string(i))));
+	}
+	EXPECT_TRUE(sender.IsStalled(now));
+	EXPECT_FALSE(sender.Queue(MakeMessage(MessageType::CHAT_MESSAGE, "one too many")));
+	// Unreliable messages are still taken, as they never wait for acks.
+	EXPECT_TRUE(sender.Queue(MakeMessage(MessageType::GAME_STATE_UPDATE, "state")));
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - ScratchArena
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <game_state.pb.h>
+
+#include "scratch-arena.hpp"
+
+using tec::ScratchArena;
+
+TEST(ScratchArena_test, ReusesBlockAcrossResets) {
+	ScratchArena arena(4096);
+	std::string transforms_scratch;
+	std::string serialized;
+	for (int tick = 0; tick < 100; ++tick) {
+		for (int client = 0; client < 8; ++client) {
+			tec::proto::GameStateUpdate* gsu = arena.Create<tec::proto::GameStateUpdate>();
+			gsu->set_state_id(tick);
+			gsu->set_command_id(client);
+			gsu->add_removed_entity(client);
+			// Lent to the message the way the server does with its fragments.
+			transforms_scratch.assign(200, static_cast<char>('a' + client));
+			gsu->mutable_transforms()->swap(transforms_scratch);
+			gsu->SerializeToString(&serialized);
+			gsu->mutable_transforms()->swap(transforms_scratch);
+		}
+		arena.Reset();
+		// Nothing was needed beyond the owned block, so the heap was never asked for more.
+		EXPECT_EQ(arena.GetSpaceAllocated(), arena.GetBlockSize());
+	}
+	tec::proto::GameStateUpdate parsed;
+	ASSERT_TRUE(parsed.ParseFromString(serialized));
+	EXPECT_EQ(parsed.state_id(), 99u);
+	EXPECT_EQ(parsed.command_id(), 7u);
+	EXPECT_EQ(parsed.transforms(), std::string(200, 'h'));
+	EXPECT_EQ(transforms_scratch, std::string(200, 'h'));
+}
+
+TEST(ScratchArena_test, OverflowIsFreedOnReset) {
+	ScratchArena arena(1024);
+	for (int i = 0; i < 200; ++i) {
+		tec::proto::GameStateUpdate* gsu = arena.Create<tec::proto::GameStateUpdate>();
+		gsu->set_state_id(i);
+		gsu->add_removed_entity(i);
+	}
+	EXPECT_GT(arena.GetSpaceAllocated(), arena.GetBlockSize());
+	arena.Reset();
+	EXPECT_EQ(arena.GetSpaceAllocated(), arena.GetBlockSize());
+}
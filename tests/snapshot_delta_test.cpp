@@ -0,0 +1,274 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests and size and decode time benchmarks of TEC - quantized snapshot deltas
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <game_state.pb.h>
+
+#include "snapshot-delta.hpp"
+
+using tec::GameState;
+
+namespace {
+	// A world where a fraction of the entities move each tick and the rest stand still.
+	class MovingWorld {
+	public:
+		MovingWorld(int entity_count, double moving_fraction) : moving(moving_fraction) {
+			std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+			for (tec::eid entity_id = 1; entity_id <= static_cast<tec::eid>(entity_count); ++entity_id) {
+				this->state.positions[entity_id] = tec::Position(glm::vec3(coordinate(this->rng), 0.0f, coordinate(this->rng)));
+				this->state.orientations[entity_id] = tec::Orientation(glm::vec3(0.0f));
+				this->state.velocities[entity_id] = tec::Velocity();
+			}
+		}
+
+		const GameState& Step() {
+			std::uniform_real_distribution<float> speed(-5.0f, 5.0f);
+			++this->state.state_id;
+			for (auto& velocity : this->state.velocities) {
+				if (this->moving(this->rng)) {
+					velocity.second.linear = glm::vec4(speed(this->rng), 0.0f, speed(this->rng), 0.0f);
+				}
+				else {
+					velocity.second.linear = glm::vec4(0.0f);
+				}
+				this->state.positions[velocity.first].value += glm::vec3(velocity.second.linear) * (1.0f / 6.0f);
+			}
+			return this->state;
+		}
+
+	private:
+		GameState state;
+		std::mt19937 rng{ 42 }; // Fixed seed so the numbers are repeatable.
+		std::bernoulli_distribution moving;
+	};
+
+	// Same state, give or take quantization.
+	void ExpectSameState(const GameState& expected, const GameState& actual) {
+		const tec::QuantizationSettings& settings = tec::REPLICATION_QUANTIZATION;
+		const float position_step = 2.0f * settings.position_range / static_cast<float>(1u << settings.position_bits);
+		const float velocity_step = 2.0f * settings.velocity_range / static_cast<float>(1u << settings.velocity_bits);
+		ASSERT_EQ(expected.positions.size(), actual.positions.size());
+		for (const auto& pos : expected.positions) {
+			ASSERT_TRUE(actual.positions.count(pos.first));
+			EXPECT_LE(glm::distance(pos.second.value, actual.positions.at(pos.first).value), position_step);
+		}
+		for (const auto& ori : expected.orientations) {
+			ASSERT_TRUE(actual.orientations.count(ori.first));
+			EXPECT_GT(std::abs(glm::dot(ori.second.value, actual.orientations.at(ori.first).value)), 0.999f);
+		}
+		for (const auto& vel : expected.velocities) {
+			ASSERT_TRUE(actual.velocities.count(vel.first));
+			EXPECT_LE(glm::distance(vel.second.linear, actual.velocities.at(vel.first).linear), velocity_step);
+		}
+	}
+}
+
+TEST(SnapshotDelta_test, RoundTrip) {
+	MovingWorld world(32, 0.5);
+	GameState baseline = world.Step();
+	world.Step();
+	GameState state = world.Step();
+	// Left since the baseline.
+	state.positions.erase(7);
+	state.orientations.erase(7);
+	state.velocities.erase(7);
+
+	tec::proto::GameStateUpdate gsu;
+	tec::WriteStateDelta(baseline, state, gsu);
+	ASSERT_EQ(gsu.removed_entity_size(), 1);
+	EXPECT_EQ(gsu.removed_entity(0), 7u);
+
+	GameState rebuilt;
+	ASSERT_TRUE(tec::ApplyStateDelta(baseline, gsu, rebuilt));
+	ExpectSameState(state, rebuilt);
+	EXPECT_EQ(rebuilt.state_id, state.state_id);
+}
+
+TEST(SnapshotDelta_test, WideQuantization) {
+	// Past 24 bits a float can't hold every step, and at 32 the step count itself overflowed.
+	for (unsigned int bits : { 24u, 31u, 32u }) {
+		const std::uint32_t max_code = tec::BitWriter::Mask(std::min(bits, tec::MAX_QUANTIZATION_BITS));
+		EXPECT_EQ(tec::QuantizeFloat(-10.0f, -10.0f, 10.0f, bits), 0u);
+		EXPECT_EQ(tec::QuantizeFloat(10.0f, -10.0f, 10.0f, bits), max_code);
+		EXPECT_EQ(tec::QuantizeFloat(100.0f, -10.0f, 10.0f, bits), max_code);
+		EXPECT_EQ(tec::DequantizeFloat(max_code, -10.0f, 10.0f, bits), 10.0f);
+		EXPECT_NEAR(tec::DequantizeFloat(tec::QuantizeFloat(1.25f, -10.0f, 10.0f, bits), -10.0f, 10.0f, bits), 1.25f, 1e-5f);
+	}
+	// No bits still gives a value in range rather than dividing by zero.
+	EXPECT_EQ(tec::DequantizeFloat(tec::QuantizeFloat(10.0f, -10.0f, 10.0f, 0), -10.0f, 10.0f, 0), 10.0f);
+}
+
+TEST(SnapshotDelta_test, UnchangedEntitiesAreOmitted) {
+	MovingWorld world(16, 0.0);
+	GameState state = world.Step();
+	tec::proto::GameStateUpdate gsu;
+	tec::WriteStateDelta(state, state, gsu);
+	EXPECT_TRUE(gsu.transforms().empty());
+
+	// Nor are they once the baseline has been through quantization, as it has on the client.
+	GameState quantized;
+	gsu.Clear();
+	tec::WriteStateDelta(GameState(), state, gsu);
+	ASSERT_TRUE(tec::ApplyStateDelta(GameState(), gsu, quantized));
+	gsu.Clear();
+	tec::WriteStateDelta(quantized, state, gsu);
+	EXPECT_TRUE(gsu.transforms().empty());
+}
+
+TEST(SnapshotDelta_test, TruncatedFragmentsAreRejected) {
+	MovingWorld world(4, 1.0);
+	tec::proto::GameStateUpdate gsu;
+	tec::WriteStateDelta(GameState(), world.Step(), gsu);
+	ASSERT_FALSE(gsu.transforms().empty());
+	gsu.mutable_transforms()->pop_back();
+	GameState rebuilt;
+	EXPECT_FALSE(tec::ApplyStateDelta(GameState(), gsu, rebuilt));
+}
+
+TEST(SnapshotDelta_test, InPlaceMatchesMessage) {
+	MovingWorld world(32, 0.5);
+	GameState baseline = world.Step();
+	GameState state = world.Step();
+	state.positions.erase(3);
+	state.orientations.erase(3);
+	state.velocities.erase(3);
+	tec::proto::GameStateUpdate gsu;
+	tec::WriteStateDelta(baseline, state, gsu);
+	gsu.set_baseline_state_id(baseline.state_id);
+	std::string data = gsu.SerializeAsString();
+
+	tec::StateUpdateHeader header;
+	ASSERT_TRUE(tec::ReadStateUpdateHeader(data.data(), data.size(), header));
+	EXPECT_EQ(header.state_id, state.state_id);
+	EXPECT_EQ(header.baseline_state_id, baseline.state_id);
+	GameState from_message, in_place;
+	ASSERT_TRUE(tec::ApplyStateDelta(baseline, gsu, from_message));
+	ASSERT_TRUE(tec::ApplyStateDelta(baseline, data.data(), data.size(), in_place));
+	EXPECT_FALSE(in_place.positions.count(3));
+	ExpectSameState(from_message, in_place);
+
+	// Fields it doesn't know about are skipped, as protobuf would.
+	data.append("\xf8\x01\x05", 3); // Field 31, varint 5.
+	ASSERT_TRUE(tec::ApplyStateDelta(baseline, data.data(), data.size(), in_place));
+	ExpectSameState(from_message, in_place);
+}
+
+TEST(SnapshotDelta_test, InPlaceRejectsMalformed) {
+	MovingWorld world(4, 1.0);
+	tec::proto::GameStateUpdate gsu;
+	tec::WriteStateDelta(GameState(), world.Step(), gsu);
+	const std::string data = gsu.SerializeAsString();
+	GameState rebuilt;
+	tec::StateUpdateHeader header;
+	// Cutting into the ids loses a required field, cutting anywhere after them cuts the transforms short.
+	const std::size_t ids_size = data.size() - gsu.transforms().size() - 2; // Tag and a one byte length.
+	for (std::size_t size = 0; size < data.size(); ++size) {
+		if (size == ids_size) {
+			continue; // A whole update with nothing in it.
+		}
+		EXPECT_FALSE(tec::ApplyStateDelta(GameState(), data.data(), size, rebuilt)) << size;
+	}
+	// Missing required fields.
+	gsu.clear_command_id();
+	const std::string partial = gsu.SerializePartialAsString();
+	EXPECT_FALSE(tec::ReadStateUpdateHeader(partial.data(), partial.size(), header));
+	// A length running past the end.
+	const char overrun[] = { 0x08, 0x01, 0x10, 0x01, 0x32, 0x7f, 0x00 };
+	EXPECT_FALSE(tec::ReadStateUpdateHeader(overrun, sizeof(overrun), header));
+}
+
+// Compares decoding a tick's update on the client in place against parsing it into a
+// GameStateUpdate first, and against a full state read with GameState::In.
+TEST(SnapshotDelta_test, DecodeTime) {
+	const int ticks = 200;
+	MovingWorld world(256, 0.25);
+	GameState baseline = world.Step();
+	std::vector<std::string> full_updates, delta_updates;
+	std::vector<GameState> states;
+	for (int tick = 0; tick < ticks; ++tick) {
+		const GameState& state = world.Step();
+		tec::proto::GameStateUpdate full;
+		state.Out(&full);
+		full.set_command_id(0);
+		full_updates.push_back(full.SerializeAsString());
+		tec::proto::GameStateUpdate delta;
+		tec::WriteStateDelta(baseline, state, delta);
+		delta_updates.push_back(delta.SerializeAsString());
+		states.push_back(state);
+	}
+
+	typedef std::chrono::high_resolution_clock clock;
+	GameState decoded;
+	auto start = clock::now();
+	for (const std::string& data : full_updates) {
+		tec::proto::GameStateUpdate gsu;
+		gsu.ParseFromString(data);
+		decoded = GameState();
+		decoded.In(gsu);
+	}
+	const auto in_time = clock::now() - start;
+	start = clock::now();
+	for (const std::string& data : delta_updates) {
+		tec::proto::GameStateUpdate gsu;
+		gsu.ParseFromString(data);
+		tec::ApplyStateDelta(baseline, gsu, decoded);
+	}
+	const auto message_time = clock::now() - start;
+	start = clock::now();
+	for (const std::string& data : delta_updates) {
+		tec::ApplyStateDelta(baseline, data.data(), data.size(), decoded);
+	}
+	const auto in_place_time = clock::now() - start;
+	ExpectSameState(states.back(), decoded);
+
+	typedef std::chrono::duration<double, std::micro> microseconds;
+	std::cout << "Decode per tick, GameState::In: " << microseconds(in_time).count() / ticks
+		<< "us, delta message: " << microseconds(message_time).count() / ticks
+		<< "us, delta in place: " << microseconds(in_place_time).count() / ticks << "us" << std::endl;
+}
+
+// Compares the bytes a client is sent per tick for a full state against a delta against the
+// state it acked a few ticks earlier, as it would be with some round trip latency.
+TEST(SnapshotDelta_test, BytesPerClientPerTick) {
+	const int ticks = 200;
+	const std::size_t ack_delay = 3;
+	MovingWorld world(64, 0.25);
+	std::deque<GameState> history;
+	std::size_t full_bytes = 0, delta_bytes = 0;
+	for (int tick = 0; tick < ticks; ++tick) {
+		const GameState& state = world.Step();
+		tec::proto::GameStateUpdate full;
+		state.Out(&full);
+		full.set_command_id(0);
+		full_bytes += full.ByteSize();
+
+		static const GameState empty_state;
+		const GameState& baseline = history.size() > ack_delay ? history.front() : empty_state;
+		tec::proto::GameStateUpdate delta;
+		tec::WriteStateDelta(baseline, state, delta);
+		delta.set_baseline_state_id(baseline.state_id);
+		delta_bytes += delta.ByteSize();
+
+		history.push_back(state);
+		if (history.size() > ack_delay + 1) {
+			history.pop_front();
+		}
+	}
+	std::cout << "Full state: " << full_bytes / ticks << " bytes per client per tick, delta: "
+		<< delta_bytes / ticks << " bytes per client per tick" << std::endl;
+	EXPECT_LT(delta_bytes, full_bytes);
+}
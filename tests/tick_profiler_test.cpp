@@ -0,0 +1,95 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - TickProfiler
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+
+#include "tick-profiler.hpp"
+
+using tec::networking::TickPhase;
+using tec::networking::TickProfiler;
+
+namespace {
+	// A clock that only moves when told to, so the profile doesn't depend on how the test is scheduled.
+	struct FakeClock {
+		TickProfiler::clock::time_point now;
+	};
+
+	// A tick where simulating takes simulate_time and everything else takes 1ms.
+	void RunTick(TickProfiler& profiler, FakeClock& clock, std::chrono::milliseconds simulate_time) {
+		const std::chrono::milliseconds other_time(1);
+		profiler.BeginTick();
+		clock.now += other_time;
+		profiler.EndPhase(TickPhase::EVENTS);
+		clock.now += simulate_time;
+		profiler.EndPhase(TickPhase::SIMULATE);
+		clock.now += other_time;
+		profiler.EndPhase(TickPhase::ENCODE);
+		clock.now += other_time;
+		profiler.EndPhase(TickPhase::SEND);
+		profiler.EndTick();
+	}
+
+	void UseClock(TickProfiler& profiler, FakeClock& clock) {
+		profiler.SetClock([&clock] () { return clock.now; });
+	}
+}
+
+TEST(TickProfiler_test, FindsTheSlowPhase) {
+	FakeClock clock;
+	TickProfiler profiler(std::chrono::milliseconds(15), 20);
+	UseClock(profiler, clock);
+	for (int i = 0; i < 19; ++i) {
+		RunTick(profiler, clock, std::chrono::milliseconds(2));
+	}
+	RunTick(profiler, clock, std::chrono::milliseconds(30));
+
+	tec::networking::TickProfile profile = profiler.GetProfile();
+	EXPECT_EQ(profile.ticks, 20u);
+	EXPECT_EQ(profile.over_budget, 1u);
+	EXPECT_EQ(profile.Get(TickPhase::SIMULATE).max, 30.0);
+	EXPECT_EQ(profile.Get(TickPhase::SIMULATE).p99, 2.0); // Rounded down to the 19th of 20.
+	EXPECT_EQ(profile.Get(TickPhase::SIMULATE).p50, 2.0);
+	EXPECT_EQ(profile.Get(TickPhase::TOTAL).max, 33.0);
+	EXPECT_EQ(profile.Get(TickPhase::TOTAL).p50, 5.0);
+	EXPECT_EQ(profile.Get(TickPhase::SEND).max, 1.0);
+	EXPECT_NE(profile.ToString().find("simulate"), std::string::npos);
+}
+
+TEST(TickProfiler_test, OnlyRecentTicksCount) {
+	FakeClock clock;
+	TickProfiler profiler(std::chrono::milliseconds(15), 5);
+	UseClock(profiler, clock);
+	RunTick(profiler, clock, std::chrono::milliseconds(30));
+	for (int i = 0; i < 5; ++i) {
+		RunTick(profiler, clock, std::chrono::milliseconds(2));
+	}
+	tec::networking::TickProfile profile = profiler.GetProfile();
+	// The slow tick has rolled out of the percentiles, but is still counted as over budget.
+	EXPECT_EQ(profile.Get(TickPhase::SIMULATE).max, 2.0);
+	EXPECT_EQ(profile.ticks, 6u);
+	EXPECT_EQ(profile.over_budget, 1u);
+}
+
+TEST(TickProfiler_test, InterleavedPhasesAreSplit) {
+	FakeClock clock;
+	TickProfiler profiler(std::chrono::milliseconds(15), 5);
+	UseClock(profiler, clock);
+	profiler.BeginTick();
+	clock.now += std::chrono::milliseconds(10);
+	// Four workers spent 24ms serializing and 8ms sending between them, in 10ms.
+	profiler.EndPhases(TickPhase::SERIALIZE, std::chrono::milliseconds(24), TickPhase::SEND, std::chrono::milliseconds(8));
+	profiler.EndTick();
+
+	tec::networking::TickProfile profile = profiler.GetProfile();
+	EXPECT_DOUBLE_EQ(profile.Get(TickPhase::SERIALIZE).max, 7.5);
+	EXPECT_DOUBLE_EQ(profile.Get(TickPhase::SEND).max, 2.5);
+	EXPECT_DOUBLE_EQ(profile.Get(TickPhase::TOTAL).max, 10.0);
+	EXPECT_NE(profile.ToString().find("serialize"), std::string::npos);
+}
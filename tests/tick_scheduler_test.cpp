@@ -0,0 +1,73 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - TickScheduler
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "tick-scheduler.hpp"
+
+using tec::networking::TickScheduler;
+using tec::networking::TickInfo;
+using tec::networking::TickReport;
+
+TEST(TickScheduler_test, FixedCadence) {
+	const auto interval = std::chrono::milliseconds(10);
+	TickScheduler scheduler(interval, 3);
+	std::vector<TickInfo> ticks;
+	std::vector<TickScheduler::clock::duration> offsets;
+	const TickScheduler::clock::time_point start = TickScheduler::clock::now();
+	scheduler.Run([&] (const TickInfo& tick) {
+		ticks.push_back(tick);
+		offsets.push_back(TickScheduler::clock::now() - start);
+		if (ticks.size() == 12) {
+			scheduler.Stop();
+		}
+	});
+
+	ASSERT_EQ(ticks.size(), 12u);
+	for (std::size_t i = 0; i < ticks.size(); ++i) {
+		EXPECT_EQ(ticks[i].tick, i + 1);
+		EXPECT_EQ(ticks[i].send_snapshot, ticks[i].tick % 3 == 0);
+		// Never before its deadline, however loaded the machine is.
+		EXPECT_GE(offsets[i], interval * static_cast<int>(i + 1));
+		if (i > 0) {
+			EXPECT_GT(offsets[i], offsets[i - 1]);
+		}
+	}
+	// Deadlines are absolute, so a late tick doesn't push back the next one. With nothing
+	// dropped, every tick ran against a deadline a whole interval after the last.
+	EXPECT_EQ(scheduler.GetStats().ticks, 12u);
+	EXPECT_EQ(scheduler.GetStats().dropped, 0u);
+}
+
+TEST(TickScheduler_test, CatchUpIsCapped) {
+	const auto interval = std::chrono::milliseconds(5);
+	TickScheduler scheduler(interval, 1, 2);
+	std::vector<TickReport> reports;
+	scheduler.SetReportHandler([&reports] (const TickReport& report) {
+		reports.push_back(report);
+	});
+	scheduler.Run([&] (const TickInfo& tick) {
+		if (tick.tick == 1) {
+			std::this_thread::sleep_for(interval * 8); // A stall worth several ticks.
+		}
+		if (tick.tick == 6) {
+			scheduler.Stop();
+		}
+	});
+
+	ASSERT_GE(reports.size(), 2u);
+	EXPECT_GT(reports[0].overrun.count(), 0);
+	// Only one more tick runs straight after the stall, the rest of the backlog is dropped.
+	EXPECT_GT(reports[1].jitter, interval * 5);
+	EXPECT_GT(scheduler.GetStats().dropped, 0u);
+	EXPECT_GE(scheduler.GetStats().overruns, 1u);
+	EXPECT_EQ(scheduler.GetStats().ticks, 6u);
+}
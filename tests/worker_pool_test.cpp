@@ -0,0 +1,60 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Unit tests of TEC - WorkerPool
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "worker-pool.hpp"
+
+using tec::networking::WorkerPool;
+
+TEST(WorkerPool_test, RunsEveryJobOnce) {
+	WorkerPool pool(3);
+	ASSERT_EQ(pool.GetThreadCount(), 3u);
+	std::vector<std::atomic<int>> runs(1000);
+	// Several batches, as it would be used every tick.
+	for (int batch = 0; batch < 50; ++batch) {
+		pool.Run(runs.size(), [&runs] (std::size_t i) {
+			++runs[i];
+		});
+	}
+	for (const auto& count : runs) {
+		EXPECT_EQ(count.load(), 50);
+	}
+}
+
+TEST(WorkerPool_test, SpreadsOverThreads) {
+	WorkerPool pool(3);
+	std::mutex ids_mutex;
+	std::set<std::thread::id> ids;
+	pool.Run(8, [&] (std::size_t) {
+		{
+			std::lock_guard<std::mutex> lock(ids_mutex);
+			ids.insert(std::this_thread::get_id());
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Long enough that no thread takes them all.
+	});
+	EXPECT_GT(ids.size(), 1u);
+}
+
+TEST(WorkerPool_test, SmallBatchesRunInline) {
+	WorkerPool pool(1);
+	int runs = 0;
+	pool.Run(0, [&runs] (std::size_t) {
+		++runs;
+	});
+	pool.Run(1, [&runs] (std::size_t) {
+		++runs;
+	});
+	EXPECT_EQ(runs, 1);
+}
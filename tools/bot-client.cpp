@@ -0,0 +1,362 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#include "bot-client.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "simulation.hpp"
+#include "snapshot-delta.hpp"
+
+namespace tec {
+	namespace networking {
+		static const double PI = 3.14159265358979323846;
+
+		const char* GetBotPatternName(BotPattern pattern) {
+			switch (pattern) {
+				case BotPattern::IDLE:
+				return "idle";
+				case BotPattern::FORWARD:
+				return "forward";
+				case BotPattern::CIRCLE:
+				return "circle";
+				case BotPattern::STRAFE:
+				return "strafe";
+				case BotPattern::WANDER:
+				return "wander";
+			}
+			return "";
+		}
+
+		bool ParseBotPattern(const std::string& name, BotPattern& pattern) {
+			for (BotPattern value : { BotPattern::IDLE, BotPattern::FORWARD, BotPattern::CIRCLE,
+				BotPattern::STRAFE, BotPattern::WANDER }) {
+				if (name == GetBotPatternName(value)) {
+					pattern = value;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void ApplyBotPattern(BotPattern pattern, std::uint32_t seed, std::uint64_t tick, double command_rate,
+			proto::ClientCommands& command) {
+			const double seconds = tick / command_rate;
+			// Spread the bots' headings out so they don't all pile up in one place.
+			double yaw = 2.0 * PI * (seed % 360) / 360.0;
+			bool forward = false, backward = false, left = false, right = false;
+			switch (pattern) {
+				case BotPattern::IDLE:
+				break;
+				case BotPattern::FORWARD:
+				forward = true;
+				break;
+				case BotPattern::CIRCLE:
+				forward = true;
+				yaw += 2.0 * PI * seconds / 10.0;
+				break;
+				case BotPattern::STRAFE:
+				left = (static_cast<std::uint64_t>(seconds) % 2) == 0;
+				right = !left;
+				break;
+				case BotPattern::WANDER:
+				{
+					// Seeded from the bot and the second so it can be worked out from any tick.
+					std::mt19937 rng(seed * 2654435761u ^ static_cast<std::uint32_t>(seconds));
+					switch (std::uniform_int_distribution<int>(0, 4)(rng)) {
+						case 0: forward = true; break;
+						case 1: backward = true; break;
+						case 2: left = true; break;
+						case 3: right = true; break;
+						default: break; // Stand still for a second.
+					}
+					yaw = std::uniform_real_distribution<double>(0.0, 2.0 * PI)(rng);
+				}
+				break;
+			}
+			proto::MovementCommand* movement = command.mutable_movement();
+			movement->set_forward(forward);
+			movement->set_backward(backward);
+			movement->set_leftstrafe(left);
+			movement->set_rightstrafe(right);
+			// A rotation of yaw about the up axis.
+			proto::OrientationCommand* orientation = command.mutable_orientation();
+			orientation->set_x(0.0f);
+			orientation->set_y(static_cast<float>(std::sin(yaw / 2.0)));
+			orientation->set_z(0.0f);
+			orientation->set_w(static_cast<float>(std::cos(yaw / 2.0)));
+		}
+
+		double BotStats::GetSnapshotRate() const {
+			if (this->snapshots < 2) {
+				return 0.0;
+			}
+			std::chrono::duration<double> elapsed = this->last_snapshot - this->first_snapshot;
+			return elapsed.count() > 0.0 ? (this->snapshots - 1) / elapsed.count() : 0.0;
+		}
+
+		BotClient::BotClient(asio::io_context& io_context, std::uint32_t index, const BotOptions& options) :
+			index(index), options(options), socket(io_context), strand(asio::make_strand(this->socket.get_executor())),
+			command_timer(this->strand), sync_timer(this->strand), server_stats_timer(this->strand) {
+			if (this->options.command_rate <= 0.0) {
+				this->options.command_rate = 1.0 / UPDATE_RATE;
+			}
+		}
+
+		void BotClient::Start(const tcp::resolver::results_type& endpoints) {
+			auto self(shared_from_this());
+			asio::async_connect(this->socket, endpoints, asio::bind_executor(this->strand,
+				[this, self] (std::error_code error, const tcp::endpoint&) {
+					if (this->stopped) {
+						return;
+					}
+					if (error) {
+						Fail(error.message());
+						return;
+					}
+					this->stats.connected = true;
+					if (this->options.compression) {
+						std::string codecs(SUPPORTED_CODECS);
+						ServerMessage compression_msg;
+						compression_msg.SetMessageType(MessageType::COMPRESSION);
+						compression_msg.SetBodyLength(codecs.size());
+						memcpy(compression_msg.GetBodyPTR(), codecs.c_str(), compression_msg.GetBodyLength());
+						compression_msg.encode_header();
+						Send(compression_msg);
+					}
+					read();
+					// Commands wait for our id, but pings can start straight away.
+					ScheduleSync();
+					if (this->options.server_stats_interval.count() > 0) {
+						ScheduleServerStats();
+					}
+				}));
+		}
+
+		void BotClient::Stop() {
+			auto self(shared_from_this());
+			asio::post(this->strand, [this, self] () {
+				this->stopped = true;
+				this->command_timer.cancel();
+				this->sync_timer.cancel();
+				this->server_stats_timer.cancel();
+				asio::error_code ignored;
+				this->socket.shutdown(tcp::socket::shutdown_both, ignored);
+				this->socket.close(ignored);
+			});
+		}
+
+		// Must run on the strand.
+		void BotClient::Fail(const std::string& reason) {
+			if (this->stopped) {
+				return; // Closing the socket ourselves aborts whatever was pending.
+			}
+			this->stats.error = reason;
+			this->stopped = true;
+			this->command_timer.cancel();
+			this->sync_timer.cancel();
+			this->server_stats_timer.cancel();
+			asio::error_code ignored;
+			this->socket.close(ignored);
+		}
+
+		void BotClient::read() {
+			auto self(shared_from_this());
+			this->socket.async_read_some(
+				asio::buffer(this->receive_buffer.GetWritePTR(), this->receive_buffer.GetWriteSpace()),
+				asio::bind_executor(this->strand,
+					[this, self] (std::error_code error, std::size_t length) {
+						if (error) {
+							Fail(error.message());
+							return;
+						}
+						this->receive_buffer.Commit(length);
+						ReceiveBuffer::Result result;
+						while ((result = this->receive_buffer.Next(this->current_read_msg)) == ReceiveBuffer::Result::MESSAGE) {
+							handle_message(this->current_read_msg);
+							if (this->stopped) {
+								return;
+							}
+						}
+						if (result == ReceiveBuffer::Result::INVALID) {
+							Fail("Invalid message header from server");
+							return;
+						}
+						read();
+					}));
+		}
+
+		void BotClient::handle_message(ServerMessage& msg) {
+			const clock::time_point now = clock::now();
+			const std::size_t wire_length = msg.length(); // What the server sent, before decompressing.
+			if (!this->decompressor.Decompress(msg)) {
+				Fail("Message failed to decompress");
+				return;
+			}
+			if (msg.GetMessageType() != MessageType::GAME_STATE_UPDATE) {
+				++this->stats.other_messages;
+				this->stats.other_bytes += wire_length;
+			}
+			switch (msg.GetMessageType()) {
+				case MessageType::GAME_STATE_UPDATE:
+				{
+					// Only the header is read. Rebuilding every bot's state would make the bots,
+					// rather than the server, the bottleneck.
+					StateUpdateHeader header;
+					if (!ReadStateUpdateHeader(msg.GetBodyPTR(), msg.GetBodyLength(), header)) {
+						Fail("Malformed GameStateUpdate");
+						return;
+					}
+					if (this->stats.snapshots == 0) {
+						this->stats.first_snapshot = now;
+					}
+					this->stats.last_snapshot = now;
+					++this->stats.snapshots;
+					this->stats.snapshot_bytes += wire_length;
+					this->stats.max_snapshot_bytes = std::max<std::uint64_t>(this->stats.max_snapshot_bytes, wire_length);
+					if (header.state_id <= this->last_received_state_id) {
+						++this->stats.stale_snapshots;
+					}
+					else {
+						this->last_received_state_id = header.state_id;
+						this->command_history.Ack(header.command_id);
+					}
+				}
+				break;
+				case MessageType::SYNC:
+				{
+					// The server echoes SYNCs, so the body still holds the time it was sent.
+					clock::rep sent;
+					if (msg.GetBodyLength() != sizeof(sent)) {
+						break;
+					}
+					memcpy(&sent, msg.GetBodyPTR(), sizeof(sent));
+					std::chrono::duration<double, std::milli> round_trip = now - clock::time_point(clock::duration(sent));
+					this->stats.round_trips.push_back(round_trip.count());
+					this->average_round_trip = this->average_round_trip == 0.0 ? round_trip.count() :
+						0.9 * this->average_round_trip + 0.1 * round_trip.count();
+				}
+				break;
+				case MessageType::CLIENT_ID:
+				if (this->stats.client_id == 0) {
+					std::string id_message(msg.GetBodyPTR(), msg.GetBodyLength());
+					this->stats.client_id = std::atoi(id_message.c_str());
+					this->next_command = now;
+					SendCommand();
+					ScheduleCommand();
+				}
+				break;
+				case MessageType::SERVER_STATS:
+				if (this->server_stats_handler) {
+					this->server_stats_handler(std::string(msg.GetBodyPTR(), msg.GetBodyLength()));
+				}
+				break;
+				default:
+				break;
+			}
+		}
+
+		// Must run on the strand.
+		void BotClient::Send(const ServerMessage& msg) {
+			if (this->stopped) {
+				return;
+			}
+			const bool write_in_progress = !this->write_msgs.empty();
+			this->write_msgs.push_back(msg);
+			if (!write_in_progress) {
+				do_write();
+			}
+		}
+
+		void BotClient::do_write() {
+			auto self(shared_from_this());
+			const ServerMessage& msg = this->write_msgs.front();
+			asio::async_write(this->socket, asio::buffer(msg.GetDataPTR(), msg.length()), asio::bind_executor(this->strand,
+				[this, self] (std::error_code error, std::size_t length) {
+					if (error) {
+						Fail(error.message());
+						return;
+					}
+					this->stats.bytes_sent += length;
+					this->write_msgs.pop_front();
+					if (!this->write_msgs.empty()) {
+						do_write();
+					}
+				}));
+		}
+
+		// Mirrors the client's main loop, which sends one command per tick.
+		void BotClient::SendCommand() {
+			proto::ClientCommands client_commands;
+			client_commands.set_id(this->stats.client_id);
+			client_commands.set_commandid(this->command_id++);
+			ApplyBotPattern(this->options.pattern, this->index, this->stats.commands_sent, this->options.command_rate,
+				client_commands);
+			const double round_trip_ticks = this->average_round_trip / (UPDATE_RATE * 1000.0);
+			this->command_tick = std::max<std::uint64_t>(this->command_tick + 1,
+				this->last_received_state_id + 1 + static_cast<std::uint64_t>(std::ceil(round_trip_ticks)));
+			client_commands.set_tick(this->command_tick);
+			this->command_history.AddPreviousCommands(client_commands);
+
+			ServerMessage update_message;
+			update_message.SetStateID(this->last_received_state_id);
+			update_message.SetMessageType(MessageType::CLIENT_COMMAND);
+			client_commands.SerializeToArray(update_message.GetBodyPTR(), client_commands.ByteSize());
+			update_message.SetBodyLength(client_commands.ByteSize());
+			update_message.encode_header();
+			Send(update_message);
+			++this->stats.commands_sent;
+		}
+
+		void BotClient::ScheduleCommand() {
+			auto self(shared_from_this());
+			this->next_command += std::chrono::duration_cast<clock::duration>(
+				std::chrono::duration<double>(1.0 / this->options.command_rate));
+			this->command_timer.expires_at(this->next_command);
+			this->command_timer.async_wait(asio::bind_executor(this->strand, [this, self] (std::error_code error) {
+				if (error || this->stopped) {
+					return;
+				}
+				SendCommand();
+				ScheduleCommand();
+			}));
+		}
+
+		void BotClient::ScheduleSync() {
+			auto self(shared_from_this());
+			this->sync_timer.expires_after(this->options.sync_interval);
+			this->sync_timer.async_wait(asio::bind_executor(this->strand, [this, self] (std::error_code error) {
+				if (error || this->stopped) {
+					return;
+				}
+				const clock::rep sent = clock::now().time_since_epoch().count();
+				ServerMessage sync_msg;
+				sync_msg.SetMessageType(MessageType::SYNC);
+				sync_msg.SetBodyLength(sizeof(sent));
+				memcpy(sync_msg.GetBodyPTR(), &sent, sizeof(sent));
+				sync_msg.encode_header();
+				Send(sync_msg);
+				ScheduleSync();
+			}));
+		}
+
+		void BotClient::ScheduleServerStats() {
+			auto self(shared_from_this());
+			this->server_stats_timer.expires_after(this->options.server_stats_interval);
+			this->server_stats_timer.async_wait(asio::bind_executor(this->strand, [this, self] (std::error_code error) {
+				if (error || this->stopped) {
+					return;
+				}
+				ServerMessage stats_msg;
+				stats_msg.SetMessageType(MessageType::SERVER_STATS);
+				stats_msg.SetBodyLength(0);
+				stats_msg.encode_header();
+				Send(stats_msg);
+				ScheduleServerStats();
+			}));
+		}
+	}
+}
@@ -0,0 +1,143 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <asio.hpp>
+#include <commands.pb.h>
+
+#include "types.hpp"
+#include "server-message.hpp"
+#include "receive-buffer.hpp"
+#include "message-compression.hpp"
+#include "command-history.hpp"
+
+using asio::ip::tcp;
+
+namespace tec {
+	namespace networking {
+		// Scripted input a bot plays back, so runs with the same options load the server the same way.
+		enum class BotPattern {
+			IDLE, // Sends commands without moving.
+			FORWARD, // Runs straight ahead.
+			CIRCLE, // Runs forward while turning, one lap every 10 seconds.
+			STRAFE, // Strafes left and right, switching every second.
+			WANDER, // Picks a new random direction and heading every second.
+		};
+
+		const char* GetBotPatternName(BotPattern pattern);
+
+		// Returns false if name isn't one of the names GetBotPatternName gives.
+		bool ParseBotPattern(const std::string& name, BotPattern& pattern);
+
+		// Sets the movement and orientation of the tick-th command sent at command_rate per second.
+		// Only depends on its arguments, so WANDER differs between bots by seed alone.
+		void ApplyBotPattern(BotPattern pattern, std::uint32_t seed, std::uint64_t tick, double command_rate,
+			proto::ClientCommands& command);
+
+		struct BotOptions {
+			double command_rate{ 0.0 }; // Commands sent per second, 0 for one per tick like the client.
+			BotPattern pattern{ BotPattern::CIRCLE };
+			std::chrono::milliseconds sync_interval{ 100 }; // Between the timed SYNCs RTT is measured with.
+			std::chrono::milliseconds server_stats_interval{ 0 }; // Between SERVER_STATS requests, 0 for never.
+			bool compression{ false }; // Offer the codecs the client does.
+		};
+
+		// Everything a bot measured. Only read it once the io_context the bot runs on has stopped.
+		struct BotStats {
+			typedef std::chrono::steady_clock clock;
+
+			bool connected{ false };
+			std::string error; // Why the connection failed or dropped, empty if it didn't.
+			eid client_id{ 0 };
+
+			std::uint64_t commands_sent{ 0 };
+			std::uint64_t bytes_sent{ 0 };
+
+			std::vector<double> round_trips; // In milliseconds, one per SYNC answered.
+
+			std::uint64_t snapshots{ 0 };
+			std::uint64_t stale_snapshots{ 0 }; // Arrived after a newer one.
+			std::uint64_t snapshot_bytes{ 0 }; // As received, including headers and any compression.
+			std::uint64_t max_snapshot_bytes{ 0 };
+			clock::time_point first_snapshot, last_snapshot;
+
+			std::uint64_t other_messages{ 0 };
+			std::uint64_t other_bytes{ 0 };
+
+			// Snapshots per second between the first and last one received.
+			double GetSnapshotRate() const;
+		};
+
+		// A headless client that speaks the same TCP protocol as the real one, for load testing.
+		// All of its handlers run on its own strand, so any number of bots can share an io_context
+		// run by any number of threads.
+		class BotClient : public std::enable_shared_from_this<BotClient> {
+		public:
+			typedef BotStats::clock clock;
+
+			BotClient(asio::io_context& io_context, std::uint32_t index, const BotOptions& options);
+
+			// Connects to the first of endpoints that accepts, then starts sending.
+			void Start(const tcp::resolver::results_type& endpoints);
+
+			// Closes the connection. Safe from any thread.
+			void Stop();
+
+			// Called on the bot's strand with the body of each SERVER_STATS reply.
+			void SetServerStatsHandler(std::function<void(const std::string&)> handler) {
+				this->server_stats_handler = std::move(handler);
+			}
+
+			const BotStats& GetStats() const {
+				return this->stats;
+			}
+
+			std::uint32_t GetIndex() const {
+				return this->index;
+			}
+		private:
+			void read();
+			void handle_message(ServerMessage& msg);
+			void Send(const ServerMessage& msg);
+			void do_write();
+			void Fail(const std::string& reason); // Records why the bot stopped and closes the connection.
+
+			void ScheduleCommand();
+			void SendCommand();
+			void ScheduleSync();
+			void ScheduleServerStats();
+
+			std::uint32_t index;
+			BotOptions options;
+			tcp::socket socket;
+			asio::strand<tcp::socket::executor_type> strand;
+			asio::steady_timer command_timer, sync_timer, server_stats_timer;
+
+			// Everything below is only touched from handlers running on the strand.
+			bool stopped{ false };
+			clock::time_point next_command; // Deadlines are absolute so the rate doesn't drift.
+			ReceiveBuffer receive_buffer;
+			ServerMessage current_read_msg;
+			MessageDecompressor decompressor;
+			std::deque<ServerMessage> write_msgs;
+
+			std::uint64_t command_id{ 1 }; // Updates ack command 0 before any have been applied.
+			std::uint64_t command_tick{ 0 };
+			CommandHistory command_history;
+			state_id_t last_received_state_id{ 0 };
+			double average_round_trip{ 0.0 }; // Milliseconds, smoothed.
+
+			std::function<void(const std::string&)> server_stats_handler;
+			BotStats stats;
+		};
+	}
+}
@@ -0,0 +1,254 @@
+// Copyright (c) 2013-2016 Trillek contributors. See AUTHORS.txt for details
+// Licensed under the terms of the LGPLv3. See licenses/lgpl-3.0.txt
+
+/**
+ * Load generator: connects a swarm of scripted bots to a server from one process and reports
+ * what each of them saw, plus the server's own tick times, when the run ends.
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "bot-client.hpp"
+
+using tec::networking::BotClient;
+using tec::networking::BotOptions;
+using tec::networking::BotPattern;
+using tec::networking::BotStats;
+
+namespace {
+	// The server's "total" tick phase, as parsed from a SERVER_STATS reply.
+	struct ServerTickSample {
+		double p50, p99, max;
+	};
+
+	// Nearest-rank percentile, 0 for no samples.
+	double Percentile(std::vector<double> samples, double percentile) {
+		if (samples.empty()) {
+			return 0.0;
+		}
+		std::size_t rank = static_cast<std::size_t>(percentile / 100.0 * (samples.size() - 1) + 0.5);
+		std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+		return samples[rank];
+	}
+
+	void PrintUsage(const char* program) {
+		std::cout << "Usage: " << program << " [options]\n"
+			<< "  --host HOST          server to connect to (127.0.0.1)\n"
+			<< "  --port PORT          server port (41228)\n"
+			<< "  --bots N             bots to connect (16)\n"
+			<< "  --rate HZ            commands each bot sends per second (one per server tick)\n"
+			<< "  --pattern NAME       idle, forward, circle, strafe or wander (circle)\n"
+			<< "  --duration SECONDS   how long to run for once the first bot starts (60)\n"
+			<< "  --ramp MS            delay between bots connecting (10)\n"
+			<< "  --threads N          threads running the bots (one per core)\n"
+			<< "  --stats-interval S   seconds between server tick profile requests, 0 for none (5)\n"
+			<< "  --compress           offer compression like the client does\n"
+			<< "  --per-client         print a line for every bot as well as the totals\n";
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::string host = "127.0.0.1", port = "41228";
+	std::size_t bot_count = 16;
+	BotOptions options;
+	double duration = 60.0;
+	std::chrono::milliseconds ramp(10);
+	std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+	std::chrono::milliseconds stats_interval(5000);
+	bool per_client = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		const bool has_value = i + 1 < argc;
+		if (arg == "--host" && has_value) {
+			host = argv[++i];
+		}
+		else if (arg == "--port" && has_value) {
+			port = argv[++i];
+		}
+		else if (arg == "--bots" && has_value) {
+			bot_count = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--rate" && has_value) {
+			options.command_rate = std::atof(argv[++i]);
+		}
+		else if (arg == "--pattern" && has_value) {
+			if (!tec::networking::ParseBotPattern(argv[++i], options.pattern)) {
+				std::cerr << "Unknown pattern " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--duration" && has_value) {
+			duration = std::atof(argv[++i]);
+		}
+		else if (arg == "--ramp" && has_value) {
+			ramp = std::chrono::milliseconds(std::atoi(argv[++i]));
+		}
+		else if (arg == "--threads" && has_value) {
+			thread_count = std::max<std::size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--stats-interval" && has_value) {
+			stats_interval = std::chrono::milliseconds(static_cast<long long>(std::atof(argv[++i]) * 1000.0));
+		}
+		else if (arg == "--compress") {
+			options.compression = true;
+		}
+		else if (arg == "--per-client") {
+			per_client = true;
+		}
+		else {
+			PrintUsage(argv[0]);
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+	if (bot_count == 0) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	asio::io_context io_context;
+	tcp::resolver::results_type endpoints;
+	try {
+		tcp::resolver resolver(io_context);
+		endpoints = resolver.resolve(host, port);
+	}
+	catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::vector<std::shared_ptr<BotClient>> bots;
+	for (std::size_t i = 0; i < bot_count; ++i) {
+		bots.push_back(std::make_shared<BotClient>(io_context, static_cast<std::uint32_t>(i), options));
+	}
+	// One bot is enough to watch the server's tick times.
+	std::vector<ServerTickSample> server_ticks;
+	if (stats_interval.count() > 0) {
+		BotOptions stats_options = options;
+		stats_options.server_stats_interval = stats_interval;
+		bots[0] = std::make_shared<BotClient>(io_context, 0, stats_options);
+		bots[0]->SetServerStatsHandler([&server_ticks] (const std::string& profile) {
+			ServerTickSample sample;
+			const std::size_t total = profile.find("total");
+			if (total != std::string::npos && std::sscanf(profile.c_str() + total, "total p50 %lfms p99 %lfms max %lfms",
+				&sample.p50, &sample.p99, &sample.max) == 3) {
+				server_ticks.push_back(sample);
+				std::printf("Server tick p50 %.2fms p99 %.2fms max %.2fms\n", sample.p50, sample.p99, sample.max);
+			}
+		});
+	}
+
+	// Ramping up, the end of the run and Ctrl-C are all handled on one strand.
+	auto control = asio::make_strand(io_context);
+	asio::steady_timer ramp_timer(control), end_timer(control);
+	asio::signal_set signals(control, SIGINT, SIGTERM);
+	std::size_t started = 0;
+	std::function<void()> start_next = [&] () {
+		bots[started++]->Start(endpoints);
+		if (started < bots.size()) {
+			ramp_timer.expires_after(ramp);
+			ramp_timer.async_wait([&start_next] (std::error_code error) {
+				if (!error) {
+					start_next();
+				}
+			});
+		}
+	};
+	auto stop_all = [&] () {
+		ramp_timer.cancel();
+		end_timer.cancel();
+		signals.cancel();
+		for (auto& bot : bots) {
+			bot->Stop();
+		}
+	};
+	signals.async_wait([&stop_all] (std::error_code error, int) {
+		if (!error) {
+			stop_all();
+		}
+	});
+	end_timer.expires_after(std::chrono::duration_cast<asio::steady_timer::duration>(std::chrono::duration<double>(duration)));
+	end_timer.async_wait([&stop_all] (std::error_code error) {
+		if (!error) {
+			stop_all();
+		}
+	});
+	asio::post(control, start_next);
+
+	std::cout << "Starting " << bot_count << " " << tec::networking::GetBotPatternName(options.pattern)
+		<< " bots against " << host << ":" << port << " on " << thread_count << " threads" << std::endl;
+	std::vector<std::thread> threads;
+	for (std::size_t i = 1; i < thread_count; ++i) {
+		threads.emplace_back([&io_context] () { io_context.run(); });
+	}
+	io_context.run();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	// Everything has stopped so the stats can be read.
+	std::size_t connected = 0, failed = 0;
+	std::uint64_t commands = 0, bytes_sent = 0, snapshots = 0, stale = 0, snapshot_bytes = 0, max_snapshot_bytes = 0;
+	std::uint64_t other_bytes = 0;
+	std::vector<double> round_trips, rates;
+	for (const auto& bot : bots) {
+		const BotStats& stats = bot->GetStats();
+		connected += stats.connected ? 1 : 0;
+		failed += stats.error.empty() ? 0 : 1;
+		commands += stats.commands_sent;
+		bytes_sent += stats.bytes_sent;
+		snapshots += stats.snapshots;
+		stale += stats.stale_snapshots;
+		snapshot_bytes += stats.snapshot_bytes;
+		max_snapshot_bytes = std::max(max_snapshot_bytes, stats.max_snapshot_bytes);
+		other_bytes += stats.other_bytes;
+		round_trips.insert(round_trips.end(), stats.round_trips.begin(), stats.round_trips.end());
+		if (stats.connected) {
+			rates.push_back(stats.GetSnapshotRate());
+		}
+		if (per_client) {
+			std::printf("Bot %u (id %lld): rtt p50 %.2fms p99 %.2fms, %llu snapshots at %.2f/s, %.0f bytes avg %llu max, "
+				"%llu commands%s%s\n", bot->GetIndex(), static_cast<long long>(stats.client_id),
+				Percentile(stats.round_trips, 50.0), Percentile(stats.round_trips, 99.0),
+				static_cast<unsigned long long>(stats.snapshots), stats.GetSnapshotRate(),
+				stats.snapshots ? static_cast<double>(stats.snapshot_bytes) / stats.snapshots : 0.0,
+				static_cast<unsigned long long>(stats.max_snapshot_bytes), static_cast<unsigned long long>(stats.commands_sent),
+				stats.error.empty() ? "" : ", failed: ", stats.error.c_str());
+		}
+	}
+
+	std::printf("%zu of %zu bots connected, %zu failed or dropped\n", connected, bots.size(), failed);
+	std::printf("Sent %llu commands (%llu bytes)\n", static_cast<unsigned long long>(commands),
+		static_cast<unsigned long long>(bytes_sent));
+	std::printf("RTT p50 %.2fms p99 %.2fms max %.2fms over %zu pings\n", Percentile(round_trips, 50.0),
+		Percentile(round_trips, 99.0), Percentile(round_trips, 100.0), round_trips.size());
+	std::printf("Snapshots: %llu received, %llu stale, %.0f bytes avg, %llu max\n",
+		static_cast<unsigned long long>(snapshots), static_cast<unsigned long long>(stale),
+		snapshots ? static_cast<double>(snapshot_bytes) / snapshots : 0.0, static_cast<unsigned long long>(max_snapshot_bytes));
+	std::printf("Snapshot rate per bot: min %.2f/s p50 %.2f/s max %.2f/s\n", Percentile(rates, 0.0),
+		Percentile(rates, 50.0), Percentile(rates, 100.0));
+	std::printf("Other messages: %llu bytes\n", static_cast<unsigned long long>(other_bytes));
+	if (!server_ticks.empty()) {
+		double worst_p99 = 0.0, worst_max = 0.0;
+		for (const ServerTickSample& sample : server_ticks) {
+			worst_p99 = std::max(worst_p99, sample.p99);
+			worst_max = std::max(worst_max, sample.max);
+		}
+		std::printf("Server tick: last p50 %.2fms, worst p99 %.2fms, worst max %.2fms over %zu samples\n",
+			server_ticks.back().p50, worst_p99, worst_max, server_ticks.size());
+	}
+
+	// Non-zero so scripted runs notice bots being refused or dropped.
+	return failed == 0 ? 0 : 1;
+}